@@ -130,6 +130,17 @@ print_maxmsgsiz(uint64_t maxmsgsiz)
 	printf("maxmsgsiz: %d\n", (int)maxmsgsiz);
 }
 
+/*
+ * Auxiliary function to print an authenticator's credential list limits on
+ * stdout.
+ */
+static void
+print_maxcredlist(uint64_t maxcredcntlst, uint64_t maxcredidlen)
+{
+	printf("maxcredcntlst: %d\n", (int)maxcredcntlst);
+	printf("maxcredidlen: %d\n", (int)maxcredidlen);
+}
+
 /*
  * Auxiliary function to print an array of bytes on stdout.
  */
@@ -190,6 +201,10 @@ getinfo(const char *path)
 	/* print maximum message size */
 	print_maxmsgsiz(fido_cbor_info_maxmsgsiz(ci));
 
+	/* print credential list limits */
+	print_maxcredlist(fido_cbor_info_maxcredcntlst(ci),
+	    fido_cbor_info_maxcredidlen(ci));
+
 	/* print supported pin protocols */
 	print_byte_array("pin protocols", fido_cbor_info_protocols_ptr(ci),
 	    fido_cbor_info_protocols_len(ci));
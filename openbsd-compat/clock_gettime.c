@@ -0,0 +1,35 @@
+/*
+ * Copyright (c) 2019 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#include "openbsd-compat.h"
+
+#if !defined(HAVE_CLOCK_GETTIME)
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <errno.h>
+
+int
+clock_gettime(clockid_t clock_id, struct timespec *tp)
+{
+	ULONGLONG ms;
+
+	if (clock_id != CLOCK_MONOTONIC) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	ms = GetTickCount64();
+	tp->tv_sec = (time_t)(ms / 1000ULL);
+	tp->tv_nsec = (long)(ms % 1000ULL) * 1000000L;
+
+	return (0);
+}
+#else
+#error "please provide an implementation of clock_gettime() for your platform"
+#endif /* _WIN32 */
+
+#endif /* !defined(HAVE_CLOCK_GETTIME) */
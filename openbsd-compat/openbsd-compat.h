@@ -56,6 +56,15 @@ int getpagesize(void);
 int timingsafe_bcmp(const void *, const void *, size_t);
 #endif
 
+#if !defined(HAVE_CLOCK_GETTIME)
+#include <time.h>
+#if !defined(CLOCK_MONOTONIC)
+typedef int clockid_t;
+#define CLOCK_MONOTONIC	1
+#endif
+int clock_gettime(clockid_t, struct timespec *);
+#endif
+
 #if !defined(HAVE_READPASSPHRASE)
 #include "readpassphrase.h"
 #else
@@ -489,6 +489,166 @@ bad_cbor_serialize(void)
 	free_assert(a);
 }
 
+/* cbor decoding budgets */
+static void
+cbor_limits(void)
+{
+	fido_assert_t *a;
+
+	assert(fido_cbor_set_limits(0, 4096, 65536) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_cbor_set_limits(16, 4096, sizeof(authdata) - 1) ==
+	    FIDO_OK);
+
+	a = alloc_assert();
+	assert(fido_assert_set_count(a, 1) == FIDO_OK);
+	assert(fido_assert_set_authdata(a, 0, authdata,
+	    sizeof(authdata)) == FIDO_ERR_CBOR_LIMIT);
+	assert(fido_assert_authdata_len(a, 0) == 0);
+	assert(fido_cbor_set_limits(16, 4096, 65536) == FIDO_OK);
+	assert(fido_assert_set_authdata(a, 0, authdata,
+	    sizeof(authdata)) == FIDO_OK);
+	free_assert(a);
+}
+
+/* second hmac-secret salt */
+static void
+hmac_salt2(void)
+{
+	fido_assert_t *a;
+	unsigned char salt[64];
+
+	memset(salt, 0x2a, sizeof(salt));
+
+	a = alloc_assert();
+	assert(fido_assert_set_hmac_salt2(a, salt, 16) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_assert_set_hmac_salt2(a, salt, 64) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_assert_set_hmac_salt2(a, salt, 32) == FIDO_OK);
+	assert(fido_assert_set_count(a, 1) == FIDO_OK);
+	assert(fido_assert_hmac_secret2_ptr(a, 0) == NULL);
+	assert(fido_assert_hmac_secret2_len(a, 0) == 0);
+	assert(fido_assert_hmac_secret2_ptr(a, 1) == NULL);
+	free_assert(a);
+}
+
+/* both hmac-secret outputs of a statement */
+static void
+hmac_secret2(void)
+{
+	fido_assert_t *a;
+	unsigned char secret[64];
+
+	for (size_t i = 0; i < sizeof(secret); i++)
+		secret[i] = (unsigned char)i;
+
+	a = alloc_assert();
+	assert(fido_assert_set_count(a, 2) == FIDO_OK);
+	assert(fido_blob_set(&a->stmt[0].hmac_secret, secret, 32) == 0);
+	assert(fido_blob_set(&a->stmt[1].hmac_secret, secret, 64) == 0);
+	assert(fido_assert_hmac_secret_len(a, 0) == 32);
+	assert(memcmp(fido_assert_hmac_secret_ptr(a, 0), secret, 32) == 0);
+	assert(fido_assert_hmac_secret2_ptr(a, 0) == NULL);
+	assert(fido_assert_hmac_secret2_len(a, 0) == 0);
+	assert(fido_assert_hmac_secret_len(a, 1) == 64);
+	assert(memcmp(fido_assert_hmac_secret_ptr(a, 1), secret, 32) == 0);
+	assert(fido_assert_hmac_secret2_len(a, 1) == 32);
+	assert(memcmp(fido_assert_hmac_secret2_ptr(a, 1), secret + 32,
+	    32) == 0);
+	assert(fido_assert_hmac_secret2_ptr(a, 2) == NULL);
+	assert(fido_assert_hmac_secret2_len(a, 2) == 0);
+	free_assert(a);
+}
+
+/* run fido_cred_list_batch() over list; record the batch sizes and order */
+static size_t
+run_batches(const fido_cbor_info_t *ci, uint64_t req_len,
+    const fido_blob_array_t *list, size_t hint, size_t *size, size_t *order)
+{
+	fido_blob_t	batch[5];
+	size_t		pos[5];
+	size_t		i = 0;
+	size_t		k = 0;
+	size_t		nb = 0;
+	size_t		n;
+
+	assert(list->len <= 5);
+
+	while ((n = fido_cred_list_batch(ci, req_len, list, hint, &i, batch,
+	    pos)) > 0) {
+		for (size_t j = 0; j < n; j++) {
+			assert(batch[j].ptr == list->ptr[pos[j]].ptr);
+			order[k++] = pos[j];
+		}
+		size[nb++] = n;
+	}
+
+	assert(k == list->len);
+
+	return (nb);
+}
+
+static void
+cred_list_batch(void)
+{
+	static unsigned char	 id[5][100];
+	fido_blob_t		 ids[5];
+	fido_blob_array_t	 list;
+	fido_cbor_info_t	 ci;
+	const uint64_t		 req_len = 128;
+	size_t			 size[5];
+	size_t			 order[5];
+	const size_t		 in_order[5] = { 0, 1, 2, 3, 4 };
+	const size_t		 mid_first[5] = { 2, 0, 1, 3, 4 };
+	const size_t		 last_first[5] = { 4, 0, 1, 2, 3 };
+
+	for (size_t i = 0; i < 5; i++) {
+		memset(id[i], (int)i + 1, sizeof(id[i]));
+		ids[i].ptr = id[i];
+		ids[i].len = sizeof(id[i]);
+	}
+
+	list.ptr = ids;
+	list.len = 5;
+
+	/* maxcredcntlst cut-off; no hint, and hints at 0, 2 and 4 */
+	memset(&ci, 0, sizeof(ci));
+	ci.maxcredcntlst = 2;
+	assert(run_batches(&ci, req_len, &list, 5, size, order) == 3);
+	assert(size[0] == 2 && size[1] == 2 && size[2] == 1);
+	assert(memcmp(order, in_order, sizeof(order)) == 0);
+	assert(run_batches(&ci, req_len, &list, 0, size, order) == 3);
+	assert(memcmp(order, in_order, sizeof(order)) == 0);
+	assert(run_batches(&ci, req_len, &list, 2, size, order) == 3);
+	assert(size[0] == 2 && size[1] == 2 && size[2] == 1);
+	assert(memcmp(order, mid_first, sizeof(order)) == 0);
+	assert(run_batches(&ci, req_len, &list, 4, size, order) == 3);
+	assert(memcmp(order, last_first, sizeof(order)) == 0);
+
+	/* maxmsgsiz cut-off: two 100-byte ids per request */
+	memset(&ci, 0, sizeof(ci));
+	ci.maxmsgsiz = req_len + 250;
+	assert(run_batches(&ci, req_len, &list, 5, size, order) == 3);
+	assert(size[0] == 2 && size[1] == 2 && size[2] == 1);
+	assert(memcmp(order, in_order, sizeof(order)) == 0);
+	assert(run_batches(&ci, req_len, &list, 2, size, order) == 3);
+	assert(memcmp(order, mid_first, sizeof(order)) == 0);
+
+	/* an entry too large on its own is still sent alone */
+	ci.maxmsgsiz = req_len + 1;
+	assert(run_batches(&ci, req_len, &list, 4, size, order) == 5);
+	for (size_t i = 0; i < 5; i++)
+		assert(size[i] == 1);
+	assert(memcmp(order, last_first, sizeof(order)) == 0);
+
+	/* no limits: a single batch */
+	memset(&ci, 0, sizeof(ci));
+	assert(run_batches(&ci, req_len, &list, 2, size, order) == 1);
+	assert(size[0] == 5);
+	assert(memcmp(order, mid_first, sizeof(order)) == 0);
+}
+
 int
 main(void)
 {
@@ -506,6 +666,10 @@ main(void)
 	junk_sig();
 	wrong_options();
 	bad_cbor_serialize();
+	cbor_limits();
+	hmac_salt2();
+	hmac_secret2();
+	cred_list_batch();
 
 	exit(0);
 }
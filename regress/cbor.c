@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2019 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#include <assert.h>
+#include <fido.h>
+#include <string.h>
+
+#define S(s)	(s), (sizeof(s) - 1)
+
+/* decode len bytes of s, wrapped in a definite text string */
+static int
+string_copy(const char *s, size_t len, char **out)
+{
+	cbor_item_t	*item;
+	unsigned char	*buf;
+	int		 r;
+
+	*out = NULL;
+
+	item = cbor_new_definite_string();
+	assert(item != NULL);
+
+	if (len > 0) {
+		buf = malloc(len);
+		assert(buf != NULL);
+		memcpy(buf, s, len);
+		cbor_string_set_handle(item, buf, len);
+	}
+
+	r = cbor_string_copy(item, out);
+	cbor_decref(&item);
+
+	return (r);
+}
+
+static void
+valid(const char *s, size_t len)
+{
+	char *out;
+
+	assert(string_copy(s, len, &out) == 0);
+	assert(out != NULL);
+	assert(memcmp(out, s, len) == 0 && out[len] == '\0');
+	free(out);
+}
+
+static void
+invalid(const char *s, size_t len)
+{
+	char *out;
+
+	assert(string_copy(s, len, &out) == FIDO_ERR_RX_INVALID_UTF8);
+	assert(out == NULL);
+}
+
+static void
+valid_utf8(void)
+{
+	valid(S(""));
+	valid(S("fido"));
+	valid(S("a string longer than a word"));
+	valid(S("caf\xc3\xa9"));
+	valid(S("\xc2\x80"));			/* U+0080 */
+	valid(S("\xe0\xa0\x80"));		/* U+0800 */
+	valid(S("\xe2\x82\xac"));		/* U+20AC */
+	valid(S("\xed\x9f\xbf"));		/* U+D7FF */
+	valid(S("\xee\x80\x80"));		/* U+E000 */
+	valid(S("\xf0\x90\x80\x80"));		/* U+10000 */
+	valid(S("\xf0\x9f\x98\x80"));		/* U+1F600 */
+	valid(S("\xf4\x8f\xbf\xbf"));		/* U+10FFFF */
+	valid(S("eight ch\xe2\x82\xac and more"));
+}
+
+static void
+overlong(void)
+{
+	invalid(S("\xc0\x80"));
+	invalid(S("\xc1\xbf"));
+	invalid(S("\xe0\x80\x80"));
+	invalid(S("\xe0\x9f\xbf"));
+	invalid(S("\xf0\x80\x80\x80"));
+	invalid(S("\xf0\x8f\xbf\xbf"));
+}
+
+static void
+surrogate(void)
+{
+	invalid(S("\xed\xa0\x80"));		/* U+D800 */
+	invalid(S("\xed\xbf\xbf"));		/* U+DFFF */
+	invalid(S("\xed\xa0\xbd\xed\xb8\x80"));	/* a CESU-8 pair */
+}
+
+static void
+truncated(void)
+{
+	invalid(S("\xc3"));
+	invalid(S("\xe2\x82"));
+	invalid(S("\xf0\x9f\x98"));
+	invalid(S("abc\xe2\x82"));
+	invalid(S("eight ch\xf0\x9f"));
+}
+
+static void
+malformed(void)
+{
+	invalid(S("\x80"));			/* stray continuation */
+	invalid(S("\xbf"));
+	invalid(S("\xe2\x28\xa1"));		/* bad continuation */
+	invalid(S("\xf0\x9f\x28\x80"));
+	invalid(S("\xf4\x90\x80\x80"));		/* beyond U+10FFFF */
+	invalid(S("\xf5\x80\x80\x80"));
+	invalid(S("\xfe"));
+	invalid(S("\xff"));
+	invalid(S("eight ch\xff"));
+}
+
+int
+main(void)
+{
+	fido_init(0);
+
+	valid_utf8();
+	overlong();
+	surrogate();
+	truncated();
+	malformed();
+
+	exit(0);
+}
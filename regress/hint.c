@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2019 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#include <assert.h>
+#include <fido.h>
+#include <string.h>
+
+static unsigned char id_a[8] = {
+	0x2f, 0x7d, 0x41, 0x0c, 0x9a, 0x53, 0xe6, 0x18,
+};
+
+static unsigned char id_b[8] = {
+	0x84, 0x1b, 0xd2, 0x6e, 0x07, 0xc9, 0x3a, 0x55,
+};
+
+static unsigned char id_c[8] = {
+	0xc3, 0x60, 0x9f, 0x2a, 0xb8, 0x14, 0x7e, 0xd1,
+};
+
+static fido_blob_t ids[3] = {
+	{ id_a, sizeof(id_a) },
+	{ id_b, sizeof(id_b) },
+	{ id_c, sizeof(id_c) },
+};
+
+static fido_blob_array_t list = { ids, 3 };
+
+static fido_dev_t *
+alloc_dev(size_t hint_max)
+{
+	fido_dev_t *d;
+
+	d = fido_dev_new();
+	assert(d != NULL);
+	assert(fido_dev_set_cred_hints(d, hint_max) == FIDO_OK);
+
+	return (d);
+}
+
+static void
+free_dev(fido_dev_t *d)
+{
+	fido_dev_free(&d);
+	assert(d == NULL);
+}
+
+static void
+no_hints(void)
+{
+	fido_dev_t		*d;
+	fido_blob_array_t	 out;
+
+	d = alloc_dev(0);
+	fido_dev_hint_put(d, "a.example", &ids[1]);
+	assert(d->hint_len == 0);
+	assert(fido_dev_hint_find(d, "a.example", &list) == list.len);
+	assert(fido_dev_hint_sort(d, "a.example", &list, &out) == 0);
+	assert(out.ptr == NULL && out.len == 0);
+	free_dev(d);
+}
+
+static void
+sort(void)
+{
+	fido_dev_t		*d;
+	fido_blob_array_t	 out;
+	fido_blob_array_t	 one = { ids, 1 };
+
+	d = alloc_dev(2);
+	assert(fido_dev_hint_find(d, "a.example", &list) == list.len);
+
+	/* the hinted entry first, sharing the list's blobs */
+	fido_dev_hint_put(d, "a.example", &ids[1]);
+	assert(fido_dev_hint_find(d, "a.example", &list) == 1);
+	assert(fido_dev_hint_find(d, "b.example", &list) == list.len);
+	assert(fido_dev_hint_sort(d, "a.example", &list, &out) == 0);
+	assert(out.len == 3);
+	assert(out.ptr[0].ptr == id_b);
+	assert(out.ptr[1].ptr == id_a);
+	assert(out.ptr[2].ptr == id_c);
+	free(out.ptr);
+
+	/* nothing to reorder */
+	fido_dev_hint_put(d, "a.example", &ids[0]);
+	assert(fido_dev_hint_find(d, "a.example", &list) == 0);
+	assert(fido_dev_hint_sort(d, "a.example", &list, &out) == 0);
+	assert(out.ptr == NULL && out.len == 0);
+	assert(fido_dev_hint_find(d, "a.example", &one) == one.len);
+	assert(fido_dev_hint_find(d, NULL, &list) == list.len);
+
+	free_dev(d);
+}
+
+static void
+eviction(void)
+{
+	fido_dev_t *d;
+
+	d = alloc_dev(2);
+
+	/* mru first */
+	fido_dev_hint_put(d, "a.example", &ids[0]);
+	fido_dev_hint_put(d, "b.example", &ids[1]);
+	assert(d->hint_len == 2);
+	assert(d->hint[0].id.len == sizeof(id_b));
+	assert(memcmp(d->hint[0].id.ptr, id_b, sizeof(id_b)) == 0);
+	assert(memcmp(d->hint[1].id.ptr, id_a, sizeof(id_a)) == 0);
+
+	/* at hint_max, the lru entry goes */
+	fido_dev_hint_put(d, "c.example", &ids[2]);
+	assert(d->hint_len == 2);
+	assert(fido_dev_hint_find(d, "a.example", &list) == list.len);
+	assert(fido_dev_hint_find(d, "b.example", &list) == 1);
+	assert(fido_dev_hint_find(d, "c.example", &list) == 2);
+
+	/* an update moves the entry to the front without evicting */
+	fido_dev_hint_put(d, "b.example", &ids[0]);
+	assert(d->hint_len == 2);
+	assert(memcmp(d->hint[0].id.ptr, id_a, sizeof(id_a)) == 0);
+	assert(fido_dev_hint_find(d, "b.example", &list) == 0);
+	assert(fido_dev_hint_find(d, "c.example", &list) == 2);
+
+	/* c.example is now the lru entry */
+	fido_dev_hint_put(d, "a.example", &ids[2]);
+	assert(d->hint_len == 2);
+	assert(fido_dev_hint_find(d, "c.example", &list) == list.len);
+	assert(fido_dev_hint_find(d, "a.example", &list) == 2);
+	assert(fido_dev_hint_find(d, "b.example", &list) == 0);
+
+	/* resetting the limit drops the hints */
+	assert(fido_dev_set_cred_hints(d, 1) == FIDO_OK);
+	assert(d->hint_len == 0);
+	assert(fido_dev_hint_find(d, "a.example", &list) == list.len);
+	fido_dev_hint_put(d, "a.example", &ids[0]);
+	fido_dev_hint_put(d, "b.example", &ids[1]);
+	assert(d->hint_len == 1);
+	assert(fido_dev_hint_find(d, "a.example", &list) == list.len);
+	assert(fido_dev_hint_find(d, "b.example", &list) == 1);
+
+	free_dev(d);
+}
+
+int
+main(void)
+{
+	fido_init(0);
+
+	no_hints();
+	sort();
+	eviction();
+
+	exit(0);
+}
@@ -9,13 +9,18 @@
 
 #include "fido.h"
 
-int
-aes256_cbc_enc(const fido_blob_t *key, const fido_blob_t *in, fido_blob_t *out)
+/*
+ * Encrypt (enc = 1) or decrypt (enc = 0) in with key, using ctx. The
+ * context is reinitialised on every call, so that a caller with several
+ * blobs to process can allocate it once.
+ */
+static int
+aes256_cbc(EVP_CIPHER_CTX *ctx, int enc, const fido_blob_t *key,
+    const fido_blob_t *in, fido_blob_t *out)
 {
-	EVP_CIPHER_CTX	*ctx = NULL;
-	unsigned char	 iv[32];
-	int		 len;
-	int		 ok = -1;
+	unsigned char	iv[32];
+	int		len;
+	int		ok = -1;
 
 	memset(iv, 0, sizeof(iv));
 	out->ptr = NULL;
@@ -28,12 +33,11 @@ aes256_cbc_enc(const fido_blob_t *key, const fido_blob_t *in, fido_blob_t *out)
 		goto fail;
 	}
 
-	if ((ctx = EVP_CIPHER_CTX_new()) == NULL || key->len != 32 ||
-	    !EVP_EncryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, key->ptr, iv) ||
-	    !EVP_CIPHER_CTX_set_padding(ctx, 0) ||
-	    !EVP_EncryptUpdate(ctx, out->ptr, &len, in->ptr, (int)in->len) ||
+	if (key->len != 32 || !EVP_CipherInit_ex(ctx, fido_evp_aes256_cbc(),
+	    NULL, key->ptr, iv, enc) || !EVP_CIPHER_CTX_set_padding(ctx, 0) ||
+	    !EVP_CipherUpdate(ctx, out->ptr, &len, in->ptr, (int)in->len) ||
 	    len < 0 || (size_t)len != in->len) {
-		log_debug("%s: EVP_Encrypt", __func__);
+		log_debug("%s: EVP_Cipher enc=%d", __func__, enc);
 		goto fail;
 	}
 
@@ -41,9 +45,6 @@ aes256_cbc_enc(const fido_blob_t *key, const fido_blob_t *in, fido_blob_t *out)
 
 	ok = 0;
 fail:
-	if (ctx != NULL)
-		EVP_CIPHER_CTX_free(ctx);
-
 	if (ok < 0) {
 		free(out->ptr);
 		out->ptr = NULL;
@@ -54,45 +55,51 @@ fail:
 }
 
 int
-aes256_cbc_dec(const fido_blob_t *key, const fido_blob_t *in, fido_blob_t *out)
+aes256_cbc_enc_ctx(EVP_CIPHER_CTX *ctx, const fido_blob_t *key,
+    const fido_blob_t *in, fido_blob_t *out)
 {
-	EVP_CIPHER_CTX	*ctx = NULL;
-	unsigned char	 iv[32];
-	int		 len;
-	int		 ok = -1;
+	return (aes256_cbc(ctx, 1, key, in, out));
+}
+
+int
+aes256_cbc_dec_ctx(EVP_CIPHER_CTX *ctx, const fido_blob_t *key,
+    const fido_blob_t *in, fido_blob_t *out)
+{
+	return (aes256_cbc(ctx, 0, key, in, out));
+}
+
+int
+aes256_cbc_enc(const fido_blob_t *key, const fido_blob_t *in, fido_blob_t *out)
+{
+	EVP_CIPHER_CTX	*ctx;
+	int		 ok;
 
-	memset(iv, 0, sizeof(iv));
 	out->ptr = NULL;
 	out->len = 0;
 
-	/* sanity check */
-	if (in->len > INT_MAX || (in->len % 16) != 0 ||
-	    (out->ptr = calloc(1, in->len)) == NULL) {
-		log_debug("%s: in->len=%zu", __func__, in->len);
-		goto fail;
-	}
+	if ((ctx = EVP_CIPHER_CTX_new()) == NULL)
+		return (-1);
 
-	if ((ctx = EVP_CIPHER_CTX_new()) == NULL || key->len != 32 ||
-	    !EVP_DecryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, key->ptr, iv) ||
-	    !EVP_CIPHER_CTX_set_padding(ctx, 0) ||
-	    !EVP_DecryptUpdate(ctx, out->ptr, &len, in->ptr, (int)in->len) ||
-	    len < 0 || (size_t)len > in->len + 32) {
-		log_debug("%s: EVP_Decrypt", __func__);
-		goto fail;
-	}
+	ok = aes256_cbc(ctx, 1, key, in, out);
+	EVP_CIPHER_CTX_free(ctx);
 
-	out->len = (size_t)len;
+	return (ok);
+}
 
-	ok = 0;
-fail:
-	if (ctx != NULL)
-		EVP_CIPHER_CTX_free(ctx);
+int
+aes256_cbc_dec(const fido_blob_t *key, const fido_blob_t *in, fido_blob_t *out)
+{
+	EVP_CIPHER_CTX	*ctx;
+	int		 ok;
 
-	if (ok < 0) {
-		free(out->ptr);
-		out->ptr = NULL;
-		out->len = 0;
-	}
+	out->ptr = NULL;
+	out->len = 0;
+
+	if ((ctx = EVP_CIPHER_CTX_new()) == NULL)
+		return (-1);
+
+	ok = aes256_cbc(ctx, 0, key, in, out);
+	EVP_CIPHER_CTX_free(ctx);
 
 	return (ok);
 }
@@ -82,16 +82,49 @@ parse_assert_reply(const cbor_item_t *key, const cbor_item_t *val, void *arg)
 	return (-1);
 }
 
+/*
+ * If a second salt was set, fill salt with salt1 || salt2, which is how
+ * the authenticator expects them. Otherwise, salt is left empty.
+ */
+static int
+join_hmac_salts(const fido_assert_t *assert, fido_blob_t *salt)
+{
+	const fido_blob_t *s1 = &assert->hmac_salt;
+	const fido_blob_t *s2 = &assert->hmac_salt2;
+
+	if (s2->ptr == NULL)
+		return (FIDO_OK);
+
+	if (s1->len != 32 || s2->len != 32) {
+		log_debug("%s: salt len=%zu, salt2 len=%zu", __func__,
+		    s1->len, s2->len);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	if ((salt->ptr = calloc(1, 64)) == NULL)
+		return (FIDO_ERR_INTERNAL);
+
+	memcpy(salt->ptr, s1->ptr, 32);
+	memcpy(salt->ptr + 32, s2->ptr, 32);
+	salt->len = 64;
+
+	return (FIDO_OK);
+}
+
 static int
 fido_dev_get_assert_tx(fido_dev_t *dev, fido_assert_t *assert,
-    const es256_pk_t *pk, const fido_blob_t *ecdh, const char *pin)
+    const es256_pk_t *pk, const fido_blob_t *ecdh, const fido_blob_t *token)
 {
 	fido_blob_t	 f;
+	fido_blob_t	 salt;
+	fido_blob_array_t cl;
 	cbor_item_t	*argv[7];
 	int		 r;
 
 	memset(argv, 0, sizeof(argv));
 	memset(&f, 0, sizeof(f));
+	memset(&salt, 0, sizeof(salt));
+	memset(&cl, 0, sizeof(cl));
 
 	/* do we have everything we need? */
 	if (assert->rp_id == NULL || assert->cdh.ptr == NULL) {
@@ -108,10 +141,16 @@ fido_dev_get_assert_tx(fido_dev_t *dev, fido_assert_t *assert,
 		goto fail;
 	}
 
-	/* allowed credentials */
+	/* allowed credentials, the one last used with this rp first */
 	if (assert->allow_list.len) {
-		const fido_blob_array_t *cl = &assert->allow_list;
-		if ((argv[2] = encode_pubkey_list(cl)) == NULL) {
+		if (fido_dev_hint_sort(dev, assert->rp_id, &assert->allow_list,
+		    &cl) < 0) {
+			log_debug("%s: fido_dev_hint_sort", __func__);
+			r = FIDO_ERR_INTERNAL;
+			goto fail;
+		}
+		if ((argv[2] = encode_pubkey_list(cl.ptr != NULL ? &cl :
+		    &assert->allow_list)) == NULL) {
 			log_debug("%s: encode_pubkey_list", __func__);
 			r = FIDO_ERR_INTERNAL;
 			goto fail;
@@ -119,13 +158,18 @@ fido_dev_get_assert_tx(fido_dev_t *dev, fido_assert_t *assert,
 	}
 
 	/* hmac-secret extension */
-	if (assert->ext & FIDO_EXT_HMAC_SECRET)
+	if (assert->ext & FIDO_EXT_HMAC_SECRET) {
+		if ((r = join_hmac_salts(assert, &salt)) != FIDO_OK) {
+			log_debug("%s: join_hmac_salts", __func__);
+			goto fail;
+		}
 		if ((argv[3] = encode_hmac_secret_param(ecdh, pk,
-		    &assert->hmac_salt)) == NULL) {
+		    salt.ptr != NULL ? &salt : &assert->hmac_salt)) == NULL) {
 			log_debug("%s: encode_hmac_secret_param", __func__);
 			r = FIDO_ERR_INTERNAL;
 			goto fail;
 		}
+	}
 
 	/* options */
 	if (assert->up != FIDO_OPT_OMIT || assert->uv != FIDO_OPT_OMIT)
@@ -137,17 +181,11 @@ fido_dev_get_assert_tx(fido_dev_t *dev, fido_assert_t *assert,
 		}
 
 	/* pin authentication */
-	if (pin) {
-		if (pk == NULL || ecdh == NULL) {
-			log_debug("%s: pin=%p, pk=%p, ecdh=%p", __func__,
-			    (const void *)pin, (const void *)pk,
-			    (const void *)ecdh);
-			r = FIDO_ERR_INVALID_ARGUMENT;
-			goto fail;
-		}
-		if ((r = add_cbor_pin_params(dev, &assert->cdh, pk, ecdh, pin,
-		    &argv[5], &argv[6])) != FIDO_OK) {
-			log_debug("%s: add_cbor_pin_params", __func__);
+	if (token != NULL) {
+		if ((argv[5] = encode_pin_auth(token, &assert->cdh)) == NULL ||
+		    (argv[6] = encode_pin_opt()) == NULL) {
+			log_debug("%s: cbor encode", __func__);
+			r = FIDO_ERR_INTERNAL;
 			goto fail;
 		}
 	}
@@ -167,25 +205,24 @@ fail:
 			cbor_decref(&argv[i]);
 
 	free(f.ptr);
+	free(cl.ptr); /* blobs shared with assert->allow_list */
+
+	if (salt.ptr != NULL) {
+		explicit_bzero(salt.ptr, salt.len);
+		free(salt.ptr);
+	}
 
 	return (r);
 }
 
 static int
-fido_dev_get_assert_rx(fido_dev_t *dev, fido_assert_t *assert, int ms)
+fido_dev_get_assert_reply(fido_assert_t *assert, const unsigned char *reply,
+    size_t reply_len)
 {
-	const uint8_t	cmd = CTAP_FRAME_INIT | CTAP_CMD_CBOR;
-	unsigned char	reply[2048];
-	int		reply_len;
-	int		r;
+	int r;
 
 	fido_assert_reset_rx(assert);
 
-	if ((reply_len = rx(dev, cmd, &reply, sizeof(reply), ms)) < 0) {
-		log_debug("%s: rx", __func__);
-		return (FIDO_ERR_RX);
-	}
-
 	/* start with room for a single assertion */
 	if ((assert->stmt = calloc(1, sizeof(fido_assert_stmt))) == NULL)
 		return (FIDO_ERR_INTERNAL);
@@ -194,14 +231,14 @@ fido_dev_get_assert_rx(fido_dev_t *dev, fido_assert_t *assert, int ms)
 	assert->stmt_cnt = 1;
 
 	/* adjust as needed */
-	if ((r = parse_cbor_reply(reply, (size_t)reply_len, assert,
+	if ((r = parse_cbor_reply(reply, reply_len, assert,
 	    adjust_assert_count)) != FIDO_OK) {
 		log_debug("%s: adjust_assert_count", __func__);
 		return (r);
 	}
 
 	/* parse the first assertion */
-	if ((r = parse_cbor_reply(reply, (size_t)reply_len,
+	if ((r = parse_cbor_reply(reply, reply_len,
 	    &assert->stmt[assert->stmt_len], parse_assert_reply)) != FIDO_OK) {
 		log_debug("%s: parse_assert_reply", __func__);
 		return (r);
@@ -212,6 +249,23 @@ fido_dev_get_assert_rx(fido_dev_t *dev, fido_assert_t *assert, int ms)
 	return (FIDO_OK);
 }
 
+static int
+fido_dev_get_assert_rx(fido_dev_t *dev, fido_assert_t *assert, int *ms)
+{
+	const uint8_t		 cmd = CTAP_FRAME_INIT | CTAP_CMD_CBOR;
+	const unsigned char	*reply;
+	int			 reply_len;
+
+	fido_assert_reset_rx(assert);
+
+	if ((reply_len = rx_msg(dev, cmd, &reply, ms)) < 0) {
+		log_debug("%s: rx", __func__);
+		return (rx_error(ms));
+	}
+
+	return (fido_dev_get_assert_reply(assert, reply, (size_t)reply_len));
+}
+
 static int
 fido_get_next_assert_tx(fido_dev_t *dev)
 {
@@ -227,17 +281,10 @@ fido_get_next_assert_tx(fido_dev_t *dev)
 }
 
 static int
-fido_get_next_assert_rx(fido_dev_t *dev, fido_assert_t *assert, int ms)
+fido_get_next_assert_reply(fido_assert_t *assert, const unsigned char *reply,
+    size_t reply_len)
 {
-	const uint8_t	cmd = CTAP_FRAME_INIT | CTAP_CMD_CBOR;
-	unsigned char	reply[2048];
-	int		reply_len;
-	int		r;
-
-	if ((reply_len = rx(dev, cmd, &reply, sizeof(reply), ms)) < 0) {
-		log_debug("%s: rx", __func__);
-		return (FIDO_ERR_RX);
-	}
+	int r;
 
 	/* sanity check */
 	if (assert->stmt_len >= assert->stmt_cnt) {
@@ -246,7 +293,7 @@ fido_get_next_assert_rx(fido_dev_t *dev, fido_assert_t *assert, int ms)
 		return (FIDO_ERR_INTERNAL);
 	}
 
-	if ((r = parse_cbor_reply(reply, (size_t)reply_len,
+	if ((r = parse_cbor_reply(reply, reply_len,
 	    &assert->stmt[assert->stmt_len], parse_assert_reply)) != FIDO_OK) {
 		log_debug("%s: parse_assert_reply", __func__);
 		return (r);
@@ -255,13 +302,30 @@ fido_get_next_assert_rx(fido_dev_t *dev, fido_assert_t *assert, int ms)
 	return (FIDO_OK);
 }
 
+static int
+fido_get_next_assert_rx(fido_dev_t *dev, fido_assert_t *assert, int *ms)
+{
+	const uint8_t		 cmd = CTAP_FRAME_INIT | CTAP_CMD_CBOR;
+	const unsigned char	*reply;
+	int			 reply_len;
+
+	if ((reply_len = rx_msg(dev, cmd, &reply, ms)) < 0) {
+		log_debug("%s: rx", __func__);
+		return (rx_error(ms));
+	}
+
+	return (fido_get_next_assert_reply(assert, reply, (size_t)reply_len));
+}
+
 static int
 fido_dev_get_assert_wait(fido_dev_t *dev, fido_assert_t *assert,
-    const es256_pk_t *pk, const fido_blob_t *ecdh, const char *pin, int ms)
+    const es256_pk_t *pk, const fido_blob_t *ecdh, const fido_blob_t *token,
+    int *ms)
 {
 	int r;
 
-	if ((r = fido_dev_get_assert_tx(dev, assert, pk, ecdh, pin)) != FIDO_OK ||
+	if ((r = fido_dev_get_assert_tx(dev, assert, pk, ecdh,
+	    token)) != FIDO_OK ||
 	    (r = fido_dev_get_assert_rx(dev, assert, ms)) != FIDO_OK)
 		return (r);
 
@@ -275,28 +339,375 @@ fido_dev_get_assert_wait(fido_dev_t *dev, fido_assert_t *assert,
 	return (FIDO_OK);
 }
 
+/* encoded size of a credential list entry, other than its id */
+#define CRED_LIST_ENTRY_LEN	24
+/* encoded size of a credential list's key and array header, at most */
+#define CRED_LIST_HDR_LEN	6
+/* encoded size of the pinAuth and pinProtocol parameters */
+#define CRED_LIST_PIN_LEN	20
+/* encoded size of the hmac-secret extension's input, at most */
+#define CRED_LIST_HMAC_LEN	180
+
+/*
+ * Measure, in *len, the request to cmd made of the argc items in argv,
+ * once a credential list is added to it. The pin parameters, which can
+ * only be encoded once a pinToken is at hand, are accounted for if pin is
+ * set.
+ */
+int
+fido_cred_list_req_len(uint8_t cmd, cbor_item_t *argv[], size_t argc,
+    bool pin, uint64_t *len)
+{
+	fido_blob_t f;
+
+	memset(&f, 0, sizeof(f));
+
+	if (cbor_build_frame(cmd, argv, argc, &f) < 0) {
+		log_debug("%s: cbor_build_frame", __func__);
+		return (FIDO_ERR_INTERNAL);
+	}
+
+	*len = f.len + CRED_LIST_HDR_LEN + (pin ? CRED_LIST_PIN_LEN : 0);
+	free(f.ptr);
+
+	return (FIDO_OK);
+}
+
+/* Measure the getAssertion request for assert, other than its allow list. */
+static int
+get_assert_req_len(const fido_assert_t *assert, const char *pin,
+    uint64_t *len)
+{
+	cbor_item_t	*argv[5];
+	int		 r;
+
+	memset(argv, 0, sizeof(argv));
+
+	if ((argv[0] = cbor_build_string(assert->rp_id)) == NULL ||
+	    (argv[1] = fido_blob_encode(&assert->cdh)) == NULL) {
+		log_debug("%s: cbor encode", __func__);
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+
+	if (assert->up != FIDO_OPT_OMIT || assert->uv != FIDO_OPT_OMIT)
+		if ((argv[4] = encode_assert_options(assert->up,
+		    assert->uv)) == NULL) {
+			log_debug("%s: encode_assert_options", __func__);
+			r = FIDO_ERR_INTERNAL;
+			goto fail;
+		}
+
+	if ((r = fido_cred_list_req_len(CTAP_CBOR_ASSERT, argv, 5, pin != NULL,
+	    len)) != FIDO_OK)
+		goto fail;
+
+	/* the extension's input depends on the shared secret */
+	if (assert->ext & FIDO_EXT_HMAC_SECRET)
+		*len += CRED_LIST_HMAC_LEN;
+fail:
+	for (size_t i = 0; i < 5; i++)
+		if (argv[i] != NULL)
+			cbor_decref(&argv[i]);
+
+	return (r);
+}
+
+/*
+ * Gather in batch, from the entries of list from *i onwards, as many
+ * credentials as fit in a single request of req_len bytes, other than its
+ * list, to the device described by ci. pos[n] records the index in list
+ * of batch[n]. The entry at index hint, if any, is taken before the
+ * others.
+ */
+size_t
+fido_cred_list_batch(const fido_cbor_info_t *ci, uint64_t req_len,
+    const fido_blob_array_t *list, size_t hint, size_t *i, fido_blob_t *batch,
+    size_t *pos)
+{
+	uint64_t	len = req_len;
+	uint64_t	entry;
+	size_t		n = 0;
+	size_t		k;
+
+	for (; *i < list->len; (*i)++) {
+		/* the hinted entry first, then the others in order */
+		if (hint == list->len)
+			k = *i;
+		else if (*i == 0)
+			k = hint;
+		else
+			k = *i <= hint ? *i - 1 : *i;
+
+		entry = CRED_LIST_ENTRY_LEN + list->ptr[k].len;
+		if (ci->maxcredcntlst != 0 && n == ci->maxcredcntlst)
+			break;
+		if (ci->maxmsgsiz != 0 && n > 0 && len + entry > ci->maxmsgsiz)
+			break;
+
+		len += entry;
+		batch[n] = list->ptr[k];
+		pos[n++] = k;
+	}
+
+	return (n);
+}
+
+/*
+ * Fill out with the entries of list whose ids are within the device's
+ * maximum length; the device cannot hold the others. The blobs are shared
+ * with list, so only out->ptr is to be freed.
+ */
+int
+fido_dev_cred_list_filter(fido_dev_t *dev, const fido_blob_array_t *list,
+    fido_blob_array_t *out, int *ms)
+{
+	const fido_cbor_info_t *ci = NULL;
+
+	memset(out, 0, sizeof(*out));
+
+	if (list->len == 0)
+		return (0);
+
+	if ((out->ptr = calloc(list->len, sizeof(*out->ptr))) == NULL)
+		return (-1);
+
+	if (fido_dev_cbor_info_load(dev, ms) == FIDO_OK)
+		ci = dev->info;
+
+	for (size_t i = 0; i < list->len; i++) {
+		if (ci != NULL && ci->maxcredidlen != 0 &&
+		    list->ptr[i].len > ci->maxcredidlen) {
+			log_debug("%s: skipping %zu, len=%zu", __func__, i,
+			    list->ptr[i].len);
+			continue;
+		}
+		out->ptr[out->len++] = list->ptr[i];
+	}
+
+	return (0);
+}
+
+/*
+ * Whether list can be added to a request of req_len bytes to dev, in a
+ * single request; true if the device's limits are unknown.
+ */
+bool
+fido_dev_cred_list_fits(fido_dev_t *dev, uint64_t req_len,
+    const fido_blob_array_t *list, int *ms)
+{
+	const fido_cbor_info_t	*ci;
+	uint64_t		 len = req_len;
+
+	if (list->len == 0 || fido_dev_cbor_info_load(dev, ms) != FIDO_OK)
+		return (true);
+
+	ci = dev->info;
+
+	if (ci->maxcredcntlst != 0 && list->len > ci->maxcredcntlst)
+		return (false);
+
+	for (size_t i = 0; i < list->len; i++)
+		len += CRED_LIST_ENTRY_LEN + list->ptr[i].len;
+
+	return (ci->maxmsgsiz == 0 || len <= ci->maxmsgsiz);
+}
+
+/*
+ * Look for a credential of rp_id held by dev among the entries of list,
+ * which does not fit in a single request, with silent (up=false)
+ * assertions over batches of it. On success, *idx is the index of the
+ * credential found, or list->len if there is none. If pin is set, the
+ * probes carry a pinAuth, without which the authenticator hides
+ * credentials that require user verification.
+ */
+int
+fido_dev_cred_list_probe(fido_dev_t *dev, char *rp_id, const char *pin,
+    const fido_blob_array_t *list, size_t *idx, int *ms)
+{
+	fido_assert_t	 probe;
+	unsigned char	 cdh[SHA256_DIGEST_LENGTH];
+	es256_pk_t	*pk = NULL;
+	fido_blob_t	*ecdh = NULL;
+	fido_blob_t	*token = NULL;
+	fido_blob_t	*batch = NULL;
+	size_t		*pos = NULL;
+	const fido_blob_t *id;
+	uint64_t	 len;
+	size_t		 hint;
+	size_t		 i = 0;
+	size_t		 n;
+	int		 r;
+
+	*idx = list->len;
+
+	memset(&probe, 0, sizeof(probe));
+	memset(&cdh, 0, sizeof(cdh));
+
+	if ((r = fido_dev_cbor_info_load(dev, ms)) != FIDO_OK) {
+		log_debug("%s: fido_dev_cbor_info_load", __func__);
+		return (r);
+	}
+
+	if ((batch = calloc(list->len, sizeof(*batch))) == NULL ||
+	    (pos = calloc(list->len, sizeof(*pos))) == NULL) {
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+
+	/* borrowed; only the reply is released */
+	probe.rp_id = rp_id;
+	probe.cdh.ptr = cdh;
+	probe.cdh.len = sizeof(cdh);
+	probe.up = FIDO_OPT_FALSE;
+
+	if ((r = get_assert_req_len(&probe, pin, &len)) != FIDO_OK)
+		goto fail;
+
+	if (pin != NULL) {
+		if ((token = fido_blob_new()) == NULL) {
+			r = FIDO_ERR_INTERNAL;
+			goto fail;
+		}
+		if (fido_dev_pin_token_cached(dev, pin) == false &&
+		    (r = fido_do_ecdh(dev, &pk, &ecdh, ms)) != FIDO_OK) {
+			log_debug("%s: fido_do_ecdh", __func__);
+			goto fail;
+		}
+		if ((r = fido_dev_pin_token_load(dev, pin, pk, ecdh, token,
+		    ms)) != FIDO_OK) {
+			log_debug("%s: fido_dev_pin_token_load", __func__);
+			goto fail;
+		}
+	}
+
+	hint = fido_dev_hint_find(dev, rp_id, list);
+
+	while ((n = fido_cred_list_batch(dev->info, len, list, hint, &i, batch,
+	    pos)) > 0) {
+		probe.allow_list.ptr = batch;
+		probe.allow_list.len = n;
+		log_debug("%s: probing %zu credentials", __func__, n);
+		r = fido_dev_get_assert_wait(dev, &probe, NULL, NULL, token,
+		    ms);
+		if (r == FIDO_ERR_NO_CREDENTIALS)
+			continue;
+		if (r != FIDO_OK) {
+			log_debug("%s: fido_dev_get_assert_wait", __func__);
+			goto fail;
+		}
+		if (n == 1) {
+			*idx = pos[0];
+			break;
+		}
+		id = probe.stmt_len > 0 ? &probe.stmt[0].id : NULL;
+		for (size_t j = 0; id != NULL && j < n; j++)
+			if (batch[j].len == id->len &&
+			    memcmp(batch[j].ptr, id->ptr, id->len) == 0)
+				*idx = pos[j];
+		if (*idx == list->len) {
+			log_debug("%s: unknown credential", __func__);
+			r = FIDO_ERR_RX;
+			goto fail;
+		}
+		break;
+	}
+
+	r = FIDO_OK;
+fail:
+	fido_assert_reset_rx(&probe);
+	es256_pk_free(&pk);
+	fido_blob_free(&ecdh);
+	fido_blob_free(&token);
+	free(batch);
+	free(pos);
+
+	return (r);
+}
+
+/* Remember which of the allowed credentials the authenticator used. */
+static void
+assert_hint_put(fido_dev_t *dev, const fido_assert_t *assert)
+{
+	if (assert->allow_list.len > 1 && assert->stmt_len > 0)
+		fido_dev_hint_put(dev, assert->rp_id, &assert->stmt[0].id);
+}
+
 static int
 decrypt_hmac_secrets(fido_assert_t *assert, const fido_blob_t *key)
 {
+	EVP_CIPHER_CTX	*ctx;
+	int		 ok = -1;
+
+	if ((ctx = EVP_CIPHER_CTX_new()) == NULL)
+		return (-1);
+
 	for (size_t i = 0; i < assert->stmt_cnt; i++) {
 		fido_assert_stmt *stmt = &assert->stmt[i];
 		if (stmt->hmac_secret_enc.ptr != NULL) {
-			if (aes256_cbc_dec(key, &stmt->hmac_secret_enc,
+			if (aes256_cbc_dec_ctx(ctx, key, &stmt->hmac_secret_enc,
 			    &stmt->hmac_secret) < 0) {
 				log_debug("%s: aes256_cbc_dec %zu", __func__, i);
-				return (-1);
+				goto fail;
 			}
 		}
 	}
 
-	return (0);
+	ok = 0;
+fail:
+	EVP_CIPHER_CTX_free(ctx);
+
+	return (ok);
+}
+
+/*
+ * Run a getAssertion with pin, agreeing on a shared secret first where one
+ * is needed; *pk and *ecdh are returned for decrypt_hmac_secrets().
+ */
+static int
+get_assert_session(fido_dev_t *dev, fido_assert_t *assert, const char *pin,
+    es256_pk_t **pk, fido_blob_t **ecdh, int *ms)
+{
+	fido_blob_t	*token = NULL;
+	int		 r;
+
+	if ((pin != NULL && fido_dev_pin_token_cached(dev, pin) == false) ||
+	    assert->ext != 0) {
+		if ((r = fido_do_ecdh(dev, pk, ecdh, ms)) != FIDO_OK) {
+			log_debug("%s: fido_do_ecdh", __func__);
+			return (r);
+		}
+	}
+
+	if (pin != NULL) {
+		if ((token = fido_blob_new()) == NULL)
+			return (FIDO_ERR_INTERNAL);
+		if ((r = fido_dev_pin_token_load(dev, pin, *pk, *ecdh, token,
+		    ms)) != FIDO_OK) {
+			log_debug("%s: fido_dev_pin_token_load", __func__);
+			fido_blob_free(&token);
+			return (r);
+		}
+	}
+
+	r = fido_dev_get_assert_wait(dev, assert, *pk, *ecdh, token, ms);
+	fido_dev_pin_session_check(dev, r);
+	fido_blob_free(&token);
+
+	return (r);
 }
 
 int
 fido_dev_get_assert(fido_dev_t *dev, fido_assert_t *assert, const char *pin)
 {
+	fido_blob_array_t allow;
+	fido_blob_array_t usable;
 	fido_blob_t	*ecdh = NULL;
 	es256_pk_t	*pk = NULL;
+	uint64_t	 len;
+	size_t		 idx;
+	bool		 cached;
+	int		 ms = dev->timeout_ms;
 	int		 r;
 
 	if (assert->rp_id == NULL || assert->cdh.ptr == NULL) {
@@ -305,20 +716,81 @@ fido_dev_get_assert(fido_dev_t *dev, fido_assert_t *assert, const char *pin)
 		return (FIDO_ERR_INVALID_ARGUMENT);
 	}
 
+	if (fido_dev_is_fido2(dev) == false &&
+	    (pin != NULL || assert->ext != 0))
+		return (FIDO_ERR_UNSUPPORTED_OPTION);
+
+	allow = assert->allow_list;
+	memset(&usable, 0, sizeof(usable));
+
+	fido_dev_op_begin(dev);
+
 	if (fido_dev_is_fido2(dev) == false) {
-		if (pin != NULL || assert->ext != 0)
-			return (FIDO_ERR_UNSUPPORTED_OPTION);
-		return (u2f_authenticate(dev, assert, -1));
+		r = u2f_authenticate(dev, assert, &ms);
+		goto fail;
 	}
 
-	if (pin != NULL || assert->ext != 0) {
-		if ((r = fido_do_ecdh(dev, &pk, &ecdh)) != FIDO_OK) {
-			log_debug("%s: fido_do_ecdh", __func__);
+	/*
+	 * Leave out credentials the device cannot hold. If the rest still
+	 * exceed its limits, find out which one it holds and ask for an
+	 * assertion with that one alone.
+	 */
+	if (fido_dev_cred_list_filter(dev, &allow, &usable, &ms) < 0) {
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+
+	if (allow.len > 0 && usable.len == 0) {
+		log_debug("%s: no usable credentials", __func__);
+		r = FIDO_ERR_NO_CREDENTIALS;
+		goto fail;
+	}
+
+	if ((r = get_assert_req_len(assert, pin, &len)) != FIDO_OK)
+		goto fail;
+
+	assert->allow_list = usable;
+	idx = usable.len == 1 ? 0 : usable.len;
+
+	if (fido_dev_cred_list_fits(dev, len, &usable, &ms) == false) {
+		if ((r = fido_dev_cred_list_probe(dev, assert->rp_id, pin,
+		    &usable, &idx, &ms)) != FIDO_OK) {
+			log_debug("%s: fido_dev_cred_list_probe", __func__);
+			goto fail;
+		}
+		if (idx == usable.len) {
+			log_debug("%s: no credentials", __func__);
+			r = FIDO_ERR_NO_CREDENTIALS;
 			goto fail;
 		}
+		assert->allow_list.ptr = &usable.ptr[idx];
+		assert->allow_list.len = 1;
+	}
+
+	cached = fido_dev_pin_session_cached(dev);
+	r = get_assert_session(dev, assert, pin, &pk, &ecdh, &ms);
+
+	if (r != FIDO_OK && cached && fido_dev_pin_session_stale(r)) {
+		log_debug("%s: 0x%x, retrying with a new session", __func__, r);
+		fido_dev_pin_session_reset(dev);
+		es256_pk_free(&pk);
+		fido_blob_free(&ecdh);
+		r = get_assert_session(dev, assert, pin, &pk, &ecdh, &ms);
+	}
+
+	assert->allow_list = allow;
+
+	/* the credential may be omitted if only one was allowed */
+	if (r == FIDO_OK && idx < usable.len && assert->stmt_len > 0 &&
+	    fido_blob_is_empty(&assert->stmt[0].id) &&
+	    fido_blob_set(&assert->stmt[0].id, usable.ptr[idx].ptr,
+	    usable.ptr[idx].len) < 0) {
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
 	}
- 
-	r = fido_dev_get_assert_wait(dev, assert, pk, ecdh, pin, -1);
+
+	if (r == FIDO_OK)
+		assert_hint_put(dev, assert);
 	if (r == FIDO_OK && assert->ext & FIDO_EXT_HMAC_SECRET)
 		if (decrypt_hmac_secrets(assert, ecdh) < 0) {
 			log_debug("%s: decrypt_hmac_secrets", __func__);
@@ -327,8 +799,119 @@ fido_dev_get_assert(fido_dev_t *dev, fido_assert_t *assert, const char *pin)
 		}
 
 fail:
+	assert->allow_list = allow;
+	free(usable.ptr); /* blobs shared with assert->allow_list */
+	es256_pk_free(&pk);
+	fido_blob_free(&ecdh);
+
+	return (fido_dev_op_end(dev, r));
+}
+
+/*
+ * Reply handler for fido_dev_get_assert_start(): requests any remaining
+ * assertions one at a time, then decrypts the hmac-secret outputs.
+ */
+static int
+fido_dev_get_assert_step(fido_dev_t *dev, void *arg,
+    const unsigned char *reply, size_t reply_len)
+{
+	fido_assert_t	*assert = arg;
+	int		 r;
+
+	if (assert->stmt == NULL) {
+		if ((r = fido_dev_get_assert_reply(assert, reply,
+		    reply_len)) != FIDO_OK)
+			return (r);
+	} else {
+		if ((r = fido_get_next_assert_reply(assert, reply,
+		    reply_len)) != FIDO_OK)
+			return (r);
+		assert->stmt_len++;
+	}
+
+	if (assert->stmt_len < assert->stmt_cnt) {
+		if ((r = fido_get_next_assert_tx(dev)) != FIDO_OK)
+			return (r);
+		return (FIDO_ERR_IN_PROGRESS);
+	}
+
+	if (assert->ext & FIDO_EXT_HMAC_SECRET)
+		if (decrypt_hmac_secrets(assert, dev->async.ecdh) < 0) {
+			log_debug("%s: decrypt_hmac_secrets", __func__);
+			return (FIDO_ERR_INTERNAL);
+		}
+
+	assert_hint_put(dev, assert);
+
+	return (FIDO_OK);
+}
+
+int
+fido_dev_get_assert_start(fido_dev_t *dev, fido_assert_t *assert,
+    const char *pin)
+{
+	fido_blob_t	*ecdh = NULL;
+	fido_blob_t	*token = NULL;
+	es256_pk_t	*pk = NULL;
+	int		 ms = 0; /* nothing below may block */
+	int		 r;
+
+	if (assert->rp_id == NULL || assert->cdh.ptr == NULL) {
+		log_debug("%s: rp_id=%p, cdh.ptr=%p", __func__,
+		    (void *)assert->rp_id, (void *)assert->cdh.ptr);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	if (fido_dev_is_fido2(dev) == false)
+		return (FIDO_ERR_UNSUPPORTED_OPTION);
+
+	/*
+	 * Obtaining a pinToken or agreeing on a shared secret would block;
+	 * only those kept by a PIN session can be used.
+	 */
+	if ((pin != NULL && fido_dev_pin_token_cached(dev, pin) == false) ||
+	    (assert->ext != 0 && fido_dev_ecdh_cached(dev) == false)) {
+		log_debug("%s: pin session not cached", __func__);
+		return (FIDO_ERR_UNSUPPORTED_OPTION);
+	}
+
+	if ((r = async_begin(dev, fido_dev_get_assert_step, assert)) != FIDO_OK)
+		return (r);
+
+	fido_assert_reset_rx(assert);
+
+	if ((pin != NULL && fido_dev_pin_token_cached(dev, pin) == false) ||
+	    assert->ext != 0) {
+		if ((r = fido_do_ecdh(dev, &pk, &ecdh, &ms)) != FIDO_OK) {
+			log_debug("%s: fido_do_ecdh", __func__);
+			goto fail;
+		}
+	}
+
+	if (pin != NULL && ((token = fido_blob_new()) == NULL ||
+	    (r = fido_dev_pin_token_load(dev, pin, pk, ecdh, token,
+	    &ms)) != FIDO_OK)) {
+		log_debug("%s: fido_dev_pin_token_load", __func__);
+		if (token == NULL)
+			r = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+
+	if ((r = fido_dev_get_assert_tx(dev, assert, pk, ecdh,
+	    token)) != FIDO_OK) {
+		log_debug("%s: fido_dev_get_assert_tx", __func__);
+		goto fail;
+	}
+
+	dev->async.ecdh = ecdh;
+	ecdh = NULL;
+fail:
+	if (r != FIDO_OK)
+		async_end(dev);
+
 	es256_pk_free(&pk);
 	fido_blob_free(&ecdh);
+	fido_blob_free(&token);
 
 	return (r);
 }
@@ -374,6 +957,11 @@ get_signed_hash(int cose_alg, fido_blob_t *dgst, const fido_blob_t *clientdata,
 	SHA256_CTX		 ctx;
 	int			 ok = -1;
 
+	if (cbor_check_limits(authdata_cbor->ptr, authdata_cbor->len) < 0) {
+		log_debug("%s: cbor_check_limits", __func__);
+		goto fail;
+	}
+
 	if ((item = cbor_load(authdata_cbor->ptr, authdata_cbor->len,
 	    &cbor)) == NULL || cbor_isa_bytestring(item) == false ||
 	    cbor_bytestring_is_definite(item) == false) {
@@ -634,6 +1222,19 @@ fido_assert_set_hmac_salt(fido_assert_t *assert, const unsigned char *salt,
 	return (FIDO_OK);
 }
 
+int
+fido_assert_set_hmac_salt2(fido_assert_t *assert, const unsigned char *salt,
+    size_t salt_len)
+{
+	if (salt_len != 32)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	if (fido_blob_set(&assert->hmac_salt2, salt, salt_len) < 0)
+		return (FIDO_ERR_INTERNAL);
+
+	return (FIDO_OK);
+}
+
 int
 fido_assert_set_rp(fido_assert_t *assert, const char *id)
 {
@@ -744,10 +1345,12 @@ fido_assert_reset_tx(fido_assert_t *assert)
 	free(assert->rp_id);
 	free(assert->cdh.ptr);
 	free(assert->hmac_salt.ptr);
+	free(assert->hmac_salt2.ptr);
 	free_blob_array(&assert->allow_list);
 
 	memset(&assert->cdh, 0, sizeof(assert->cdh));
 	memset(&assert->hmac_salt, 0, sizeof(assert->hmac_salt));
+	memset(&assert->hmac_salt2, 0, sizeof(assert->hmac_salt2));
 	memset(&assert->allow_list, 0, sizeof(assert->allow_list));
 
 	assert->rp_id = NULL;
@@ -783,6 +1386,40 @@ fido_assert_reset_rx(fido_assert_t *assert)
 	assert->stmt_cnt = 0;
 }
 
+/*
+ * Prepare dst to receive the reply to the request described by src: the
+ * request parameters are shared with src, and only the reply is owned by
+ * dst. Used to run one request against several devices at once.
+ */
+void
+fido_assert_borrow_tx(fido_assert_t *dst, const fido_assert_t *src)
+{
+	memset(dst, 0, sizeof(*dst));
+
+	dst->rp_id = src->rp_id;
+	dst->cdh = src->cdh;
+	dst->hmac_salt = src->hmac_salt;
+	dst->hmac_salt2 = src->hmac_salt2;
+	dst->allow_list = src->allow_list;
+	dst->up = src->up;
+	dst->uv = src->uv;
+	dst->ext = src->ext;
+}
+
+void
+fido_assert_move_rx(fido_assert_t *dst, fido_assert_t *src)
+{
+	fido_assert_reset_rx(dst);
+
+	dst->stmt = src->stmt;
+	dst->stmt_cnt = src->stmt_cnt;
+	dst->stmt_len = src->stmt_len;
+
+	src->stmt = NULL;
+	src->stmt_cnt = 0;
+	src->stmt_len = 0;
+}
+
 void
 fido_assert_free(fido_assert_t **assert_p)
 {
@@ -937,6 +1574,25 @@ fido_assert_hmac_secret_len(const fido_assert_t *assert, size_t idx)
 	return (assert->stmt[idx].hmac_secret.len);
 }
 
+/* With two salts, the authenticator's output is secret1 || secret2. */
+const unsigned char *
+fido_assert_hmac_secret2_ptr(const fido_assert_t *assert, size_t idx)
+{
+	if (idx >= assert->stmt_len || assert->stmt[idx].hmac_secret.len != 64)
+		return (NULL);
+
+	return (assert->stmt[idx].hmac_secret.ptr + 32);
+}
+
+size_t
+fido_assert_hmac_secret2_len(const fido_assert_t *assert, size_t idx)
+{
+	if (idx >= assert->stmt_len || assert->stmt[idx].hmac_secret.len != 64)
+		return (0);
+
+	return (32);
+}
+
 static void
 fido_assert_clean_authdata(fido_assert_stmt *as)
 {
@@ -964,6 +1620,12 @@ fido_assert_set_authdata(fido_assert_t *assert, size_t idx,
 	stmt = &assert->stmt[idx];
 	fido_assert_clean_authdata(stmt);
 
+	if (cbor_check_limits(ptr, len) < 0) {
+		log_debug("%s: cbor_check_limits", __func__);
+		r = FIDO_ERR_CBOR_LIMIT;
+		goto fail;
+	}
+
 	if ((item = cbor_load(ptr, len, &cbor)) == NULL) {
 		log_debug("%s: cbor_load", __func__);
 		r = FIDO_ERR_INVALID_ARGUMENT;
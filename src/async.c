@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2019 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#include <string.h>
+#include "fido.h"
+
+/*
+ * Claim the device for an asynchronous operation. The caller transmits the
+ * request; cb is invoked by fido_dev_step() with the reply. A resumed
+ * channel that is not yet confirmed is refused, as the replay of a request
+ * the authenticator rejects for it would block.
+ */
+int
+async_begin(fido_dev_t *dev, fido_async_cb_t *cb, void *arg)
+{
+	if (dev->io_handle == NULL || dev->async.cb != NULL) {
+		log_debug("%s: handle=%p, busy=%d", __func__, dev->io_handle,
+		    dev->async.cb != NULL);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	if (dev->resumed) {
+		log_debug("%s: resumed channel not confirmed", __func__);
+		return (FIDO_ERR_UNSUPPORTED_OPTION);
+	}
+
+	dev->async.cb = cb;
+	dev->async.arg = arg;
+	dev->async.ecdh = NULL;
+	dev->async.ready = false;
+	fido_dev_op_begin(dev);
+
+	rx_begin(dev, CTAP_FRAME_INIT | CTAP_CMD_CBOR);
+
+	return (FIDO_OK);
+}
+
+void
+async_end(fido_dev_t *dev)
+{
+	(void)fido_dev_op_end(dev, FIDO_OK);
+	fido_blob_free(&dev->async.ecdh);
+	memset(&dev->async, 0, sizeof(dev->async));
+	memset(&dev->rx, 0, sizeof(dev->rx));
+}
+
+int
+fido_dev_fd(const fido_dev_t *dev)
+{
+	if (dev->io_handle == NULL || dev->io.read != hid_read)
+		return (-1);
+
+	return (hid_fd(dev->io_handle));
+}
+
+int
+fido_dev_step(fido_dev_t *dev)
+{
+	const unsigned char	*reply;
+	size_t			 reply_len;
+	int			 ms;
+	int			 r;
+
+	if (dev->async.cb == NULL) {
+		log_debug("%s: no operation in progress", __func__);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	/* the operation was served without talking to the device */
+	if (dev->async.ready) {
+		r = dev->async.cb(dev, dev->async.arg, NULL, 0);
+		goto done;
+	}
+
+	/* without a descriptor to poll, wait for the report here */
+	ms = fido_dev_fd(dev) != -1 ? 0 : dev->timeout_ms;
+
+	switch (rx_step(dev, ms, &reply, &reply_len)) {
+	case -1:
+		log_debug("%s: rx_step", __func__);
+		r = FIDO_ERR_RX;
+		goto done;
+	case 0:
+		if (ms == 0)
+			return (FIDO_ERR_IN_PROGRESS); /* nothing pending */
+		log_debug("%s: timeout", __func__);
+		r = FIDO_ERR_USER_ACTION_TIMEOUT;
+		goto done;
+	case 1:
+		return (FIDO_ERR_IN_PROGRESS);
+	}
+
+	r = dev->async.cb(dev, dev->async.arg, reply, reply_len);
+	if (r == FIDO_ERR_IN_PROGRESS) {
+		/* the handler issued a follow-up request */
+		rx_begin(dev, dev->rx.cmd);
+		return (r);
+	}
+done:
+	r = fido_dev_op_end(dev, r);
+	async_end(dev);
+	fido_dev_pin_session_check(dev, r);
+
+	return (r);
+}
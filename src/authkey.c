@@ -20,7 +20,7 @@ parse_authkey(const cbor_item_t *key, const cbor_item_t *val, void *arg)
 	return (es256_pk_decode(val, authkey));
 }
 
-static int
+int
 fido_dev_authkey_tx(fido_dev_t *dev)
 {
 	fido_blob_t	 f;
@@ -59,21 +59,21 @@ fail:
 	return (r);
 }
 
-static int
-fido_dev_authkey_rx(fido_dev_t *dev, es256_pk_t *authkey, int ms)
+int
+fido_dev_authkey_rx(fido_dev_t *dev, es256_pk_t *authkey, int *ms)
 {
-	const uint8_t	cmd = CTAP_FRAME_INIT | CTAP_CMD_CBOR;
-	unsigned char	reply[2048];
-	int		reply_len;
+	const uint8_t		 cmd = CTAP_FRAME_INIT | CTAP_CMD_CBOR;
+	const unsigned char	*reply;
+	int			 reply_len;
 
 	log_debug("%s: dev=%p, authkey=%p, ms=%d", __func__, (void *)dev,
-	    (void *)authkey, ms);
+	    (void *)authkey, *ms);
 
 	memset(authkey, 0, sizeof(*authkey));
 
-	if ((reply_len = rx(dev, cmd, &reply, sizeof(reply), ms)) < 0) {
+	if ((reply_len = rx_msg(dev, cmd, &reply, ms)) < 0) {
 		log_debug("%s: rx", __func__);
-		return (FIDO_ERR_RX);
+		return (rx_error(ms));
 	}
 
 	return (parse_cbor_reply(reply, (size_t)reply_len, authkey,
@@ -81,7 +81,7 @@ fido_dev_authkey_rx(fido_dev_t *dev, es256_pk_t *authkey, int ms)
 }
 
 static int
-fido_dev_authkey_wait(fido_dev_t *dev, es256_pk_t *authkey, int ms)
+fido_dev_authkey_wait(fido_dev_t *dev, es256_pk_t *authkey, int *ms)
 {
 	int r;
 
@@ -95,5 +95,7 @@ fido_dev_authkey_wait(fido_dev_t *dev, es256_pk_t *authkey, int ms)
 int
 fido_dev_authkey(fido_dev_t *dev, es256_pk_t *authkey)
 {
-	return (fido_dev_authkey_wait(dev, authkey, -1));
+	int ms = dev->timeout_ms;
+
+	return (fido_dev_authkey_wait(dev, authkey, &ms));
 }
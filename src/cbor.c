@@ -5,7 +5,6 @@
  */
 
 #include <openssl/evp.h>
-#include <openssl/hmac.h>
 #include <openssl/sha.h>
 
 #include <string.h>
@@ -67,6 +66,7 @@ cbor_map_iter(const cbor_item_t *item, void *arg, int(*f)(const cbor_item_t *,
 {
 	struct cbor_pair	*v;
 	size_t			 n;
+	int			 r;
 
 	if ((v = cbor_map_handle(item)) == NULL) {
 		log_debug("%s: cbor_map_handle", __func__);
@@ -85,9 +85,9 @@ cbor_map_iter(const cbor_item_t *item, void *arg, int(*f)(const cbor_item_t *,
 			log_debug("%s: ctap_check_cbor", __func__);
 			return (-1);
 		}
-		if (f(v[i].key, v[i].value, arg) < 0) {
+		if ((r = f(v[i].key, v[i].value, arg)) < 0) {
 			log_debug("%s: iterator < 0 on i=%zu", __func__, i);
-			return (-1);
+			return (r);
 		}
 	}
 
@@ -100,6 +100,7 @@ cbor_array_iter(const cbor_item_t *item, void *arg, int(*f)(const cbor_item_t *,
 {
 	cbor_item_t	**v;
 	size_t		  n;
+	int		  r;
 
 	if ((v = cbor_array_handle(item)) == NULL) {
 		log_debug("%s: cbor_array_handle", __func__);
@@ -109,11 +110,184 @@ cbor_array_iter(const cbor_item_t *item, void *arg, int(*f)(const cbor_item_t *,
 	n = cbor_array_size(item);
 
 	for (size_t i = 0; i < n; i++)
-		if (v[i] == NULL || f(v[i], arg) < 0) {
+		if (v[i] == NULL || (r = f(v[i], arg)) < 0) {
 			log_debug("%s: iterator < 0 on i=%zu,%p", __func__, i,
 			    (void *)v[i]);
+			return (v[i] == NULL ? -1 : r);
+		}
+
+	return (0);
+}
+
+/*
+ * Budgets applied to CBOR input before it is handed to cbor_load(), which
+ * would otherwise allocate in proportion to whatever the input claims.
+ * They are set once, like fido_init(), before any thread decodes; see
+ * fido_cbor_set_limits(3).
+ */
+#define CBOR_MAX_DEPTH_LIMIT	64
+
+static size_t	cbor_max_depth = 16;
+static size_t	cbor_max_items = 4096;
+static size_t	cbor_max_len = 65536;
+
+int
+fido_cbor_set_limits(size_t max_depth, size_t max_items, size_t max_len)
+{
+	if (max_depth == 0 || max_depth > CBOR_MAX_DEPTH_LIMIT ||
+	    max_items == 0 || max_len == 0)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	cbor_max_depth = max_depth;
+	cbor_max_items = max_items;
+	cbor_max_len = max_len;
+
+	return (FIDO_OK);
+}
+
+static int
+cbor_scan_head(const unsigned char **buf, size_t *len, uint8_t *type,
+    uint8_t *info, uint64_t *arg)
+{
+	uint8_t	 v;
+	size_t	 n;
+
+	if (*len < 1)
+		return (-1);
+
+	*type = (uint8_t)(**buf >> 5);
+	*info = (uint8_t)(**buf & 0x1f);
+	*arg = 0;
+	(*buf)++;
+	(*len)--;
+
+	if (*info < 24) {
+		*arg = *info;
+		return (0);
+	} else if (*info > 27)
+		return (*info == 31 ? 0 : -1);
+
+	n = (size_t)1 << (*info - 24);
+	if (*len < n)
+		return (-1);
+
+	while (n--) {
+		v = *(*buf)++;
+		(*len)--;
+		*arg = (*arg << 8) | v;
+	}
+
+	return (0);
+}
+
+/*
+ * Walk the first data item in buf without allocating, charging every item
+ * against *items. Returns 0 if the item fits the budget, 1 if it is
+ * malformed (left for cbor_load() to reject), and -1 if a budget is
+ * exceeded.
+ */
+static int
+cbor_scan_item(const unsigned char **buf, size_t *len, size_t depth,
+    size_t *items)
+{
+	uint8_t		type;
+	uint8_t		info;
+	uint64_t	arg;
+	uint64_t	n;
+	int		r;
+
+	if (*items == 0) {
+		log_debug("%s: too many items", __func__);
+		return (-1);
+	}
+
+	(*items)--;
+
+	if (cbor_scan_head(buf, len, &type, &info, &arg) < 0)
+		return (1);
+
+	switch (type) {
+	case 0: /* unsigned integer */
+	case 1: /* negative integer */
+	case 7: /* float, simple value */
+		return (info == 31 ? 1 : 0);
+	case 2: /* byte string */
+	case 3: /* text string */
+		if (info != 31) {
+			if (arg > *len)
+				return (1);
+			*buf += arg;
+			*len -= (size_t)arg;
+			return (0);
+		}
+		/* indefinite length; definite chunks of the same type */
+		while (*len > 0 && **buf != 0xff) {
+			if ((**buf >> 5) != type || (**buf & 0x1f) == 31)
+				return (1);
+			if ((r = cbor_scan_item(buf, len, depth, items)) != 0)
+				return (r);
+		}
+		break;
+	case 4: /* array */
+	case 5: /* map */
+	case 6: /* tag */
+		if (depth == 0) {
+			log_debug("%s: too deep", __func__);
 			return (-1);
 		}
+		if (type == 6) {
+			if (info == 31)
+				return (1);
+			return (cbor_scan_item(buf, len, depth - 1, items));
+		}
+		if (info != 31) {
+			/* reject before cbor_load() preallocates the handle */
+			if (arg > *items || (type == 5 && arg > *items / 2)) {
+				log_debug("%s: too many items", __func__);
+				return (-1);
+			}
+			n = type == 5 ? arg * 2 : arg;
+			if (n > *len)
+				return (1);
+			while (n--)
+				if ((r = cbor_scan_item(buf, len, depth - 1,
+				    items)) != 0)
+					return (r);
+			return (0);
+		}
+		while (*len > 0 && **buf != 0xff)
+			if ((r = cbor_scan_item(buf, len, depth - 1,
+			    items)) != 0)
+				return (r);
+		break;
+	}
+
+	/* consume the break code of an indefinite length item */
+	if (*len < 1)
+		return (1);
+
+	(*buf)++;
+	(*len)--;
+
+	return (0);
+}
+
+int
+cbor_check_limits(const unsigned char *ptr, size_t len)
+{
+	const unsigned char	*buf = ptr;
+	size_t			 left = len;
+	size_t			 items = cbor_max_items;
+
+	if (cbor_scan_item(&buf, &left, cbor_max_depth, &items) < 0) {
+		log_debug("%s: cbor_scan_item", __func__);
+		return (-1);
+	}
+
+	if ((size_t)(buf - ptr) > cbor_max_len) {
+		log_debug("%s: len=%zu", __func__, (size_t)(buf - ptr));
+		return (-1);
+	}
 
 	return (0);
 }
@@ -138,6 +312,12 @@ parse_cbor_reply(const unsigned char *blob, size_t blob_len, void *arg,
 		goto fail;
 	}
 
+	if (cbor_check_limits(blob + 1, blob_len - 1) < 0) {
+		log_debug("%s: cbor_check_limits", __func__);
+		r = FIDO_ERR_CBOR_LIMIT;
+		goto fail;
+	}
+
 	if ((item = cbor_load(blob + 1, blob_len - 1, &cbor)) == NULL) {
 		log_debug("%s: cbor_load", __func__);
 		r = FIDO_ERR_RX_NOT_CBOR;
@@ -151,9 +331,10 @@ parse_cbor_reply(const unsigned char *blob, size_t blob_len, void *arg,
 		goto fail;
 	}
 
-	if (cbor_map_iter(item, arg, parser) < 0) {
+	if ((r = cbor_map_iter(item, arg, parser)) < 0) {
 		log_debug("%s: cbor_map_iter", __func__);
-		r = FIDO_ERR_RX_INVALID_CBOR;
+		if (r != FIDO_ERR_RX_INVALID_UTF8)
+			r = FIDO_ERR_RX_INVALID_CBOR;
 		goto fail;
 	}
 
@@ -190,6 +371,70 @@ cbor_bytestring_copy(const cbor_item_t *item, unsigned char **buf, size_t *len)
 	return (0);
 }
 
+/*
+ * Copy len bytes from src to dst, checking that they form well-formed UTF-8
+ * as defined in RFC 3629: no overlong forms, surrogates, or code points
+ * beyond U+10FFFF. Runs of ASCII are copied a word at a time.
+ */
+static int
+utf8_copy(unsigned char *dst, const unsigned char *src, size_t len)
+{
+	uint64_t	w;
+	size_t		i = 0;
+	size_t		n;
+	unsigned char	c;
+	unsigned char	lo;
+	unsigned char	hi;
+
+	while (i < len) {
+		if (len - i >= sizeof(w)) {
+			memcpy(&w, src + i, sizeof(w));
+			if ((w & 0x8080808080808080ULL) == 0) {
+				memcpy(dst + i, &w, sizeof(w));
+				i += sizeof(w);
+				continue;
+			}
+		}
+
+		if ((c = src[i]) < 0x80) {
+			dst[i++] = c;
+			continue;
+		}
+
+		lo = 0x80;
+		hi = 0xbf;
+
+		if (c >= 0xc2 && c <= 0xdf)
+			n = 1;
+		else if (c >= 0xe0 && c <= 0xef) {
+			n = 2;
+			if (c == 0xe0)
+				lo = 0xa0;
+			else if (c == 0xed)
+				hi = 0x9f;
+		} else if (c >= 0xf0 && c <= 0xf4) {
+			n = 3;
+			if (c == 0xf0)
+				lo = 0x90;
+			else if (c == 0xf4)
+				hi = 0x8f;
+		} else
+			return (-1);
+
+		if (len - i <= n || src[i + 1] < lo || src[i + 1] > hi)
+			return (-1);
+
+		for (size_t j = 2; j <= n; j++)
+			if ((src[i + j] & 0xc0) != 0x80)
+				return (-1);
+
+		memcpy(dst + i, src + i, n + 1);
+		i += n + 1;
+	}
+
+	return (0);
+}
+
 int
 cbor_string_copy(const cbor_item_t *item, char **str)
 {
@@ -210,7 +455,14 @@ cbor_string_copy(const cbor_item_t *item, char **str)
 	    (*str = malloc(len + 1)) == NULL)
 		return (-1);
 
-	memcpy(*str, cbor_string_handle(item), len);
+	if (utf8_copy((unsigned char *)*str, cbor_string_handle(item),
+	    len) < 0) {
+		log_debug("%s: invalid utf-8", __func__);
+		free(*str);
+		*str = NULL;
+		return (FIDO_ERR_RX_INVALID_UTF8);
+	}
+
 	(*str)[len] = '\0';
 
 	return (0);
@@ -581,13 +833,9 @@ encode_assert_options(fido_opt_t up, fido_opt_t uv)
 cbor_item_t *
 encode_pin_auth(const fido_blob_t *hmac_key, const fido_blob_t *data)
 {
-	const EVP_MD	*md = NULL;
-	unsigned char	 dgst[SHA256_DIGEST_LENGTH];
-	unsigned int	 dgst_len;
+	unsigned char dgst[SHA256_DIGEST_LENGTH];
 
-	if ((md = EVP_sha256()) == NULL || HMAC(md, hmac_key->ptr,
-	    (int)hmac_key->len, data->ptr, (int)data->len, dgst,
-	    &dgst_len) == NULL || dgst_len != SHA256_DIGEST_LENGTH)
+	if (fido_hmac_sha256(hmac_key, data, NULL, dgst) < 0)
 		return (NULL);
 
 	return (cbor_build_bytestring(dgst, 16));
@@ -622,7 +870,8 @@ sha256(const unsigned char *data, size_t data_len, fido_blob_t *digest)
 
 	digest->len = SHA256_DIGEST_LENGTH;
 
-	if (SHA256(data, data_len, digest->ptr) != digest->ptr) {
+	if (EVP_Digest(data, data_len, digest->ptr, NULL, fido_evp_sha256(),
+	    NULL) == 0) {
 		free(digest->ptr);
 		digest->ptr = NULL;
 		digest->len = 0;
@@ -637,14 +886,8 @@ encode_change_pin_auth(const fido_blob_t *key, const fido_blob_t *new_pin,
     const fido_blob_t *pin)
 {
 	unsigned char	 dgst[SHA256_DIGEST_LENGTH];
-	unsigned int	 dgst_len;
 	cbor_item_t	*item = NULL;
-	const EVP_MD	*md = NULL;
-#if OPENSSL_VERSION_NUMBER < 0x10100000L
-	HMAC_CTX	 ctx;
-#else
-	HMAC_CTX	*ctx = NULL;
-#endif
+	EVP_CIPHER_CTX	*ctx = NULL;
 	fido_blob_t	*npe = NULL; /* new pin, encrypted */
 	fido_blob_t	*ph = NULL;  /* pin hash */
 	fido_blob_t	*phe = NULL; /* pin hash, encrypted */
@@ -652,10 +895,11 @@ encode_change_pin_auth(const fido_blob_t *key, const fido_blob_t *new_pin,
 
 	if ((npe = fido_blob_new()) == NULL ||
 	    (ph = fido_blob_new()) == NULL ||
-	    (phe = fido_blob_new()) == NULL)
+	    (phe = fido_blob_new()) == NULL ||
+	    (ctx = EVP_CIPHER_CTX_new()) == NULL)
 		goto fail;
 
-	if (aes256_cbc_enc(key, new_pin, npe) < 0) {
+	if (aes256_cbc_enc_ctx(ctx, key, new_pin, npe) < 0) {
 		log_debug("%s: aes256_cbc_enc 1", __func__);
 		goto fail;
 	}
@@ -667,33 +911,15 @@ encode_change_pin_auth(const fido_blob_t *key, const fido_blob_t *new_pin,
 
 	ph->len = 16; /* first 16 bytes */
 
-	if (aes256_cbc_enc(key, ph, phe) < 0) {
+	if (aes256_cbc_enc_ctx(ctx, key, ph, phe) < 0) {
 		log_debug("%s: aes256_cbc_enc 2", __func__);
 		goto fail;
 	}
 
-#if OPENSSL_VERSION_NUMBER < 0x10100000L
-	HMAC_CTX_init(&ctx);
-
-	if ((md = EVP_sha256()) == NULL ||
-	    HMAC_Init_ex(&ctx, key->ptr, (int)key->len, md, NULL) == 0 ||
-	    HMAC_Update(&ctx, npe->ptr, (int)npe->len) == 0 ||
-	    HMAC_Update(&ctx, phe->ptr, (int)phe->len) == 0 ||
-	    HMAC_Final(&ctx, dgst, &dgst_len) == 0 || dgst_len != 32) {
-		log_debug("%s: HMAC", __func__);
-		goto fail;
-	}
-#else
-	if ((ctx = HMAC_CTX_new()) == NULL ||
-	    (md = EVP_sha256())  == NULL ||
-	    HMAC_Init_ex(ctx, key->ptr, (int)key->len, md, NULL) == 0 ||
-	    HMAC_Update(ctx, npe->ptr, (int)npe->len) == 0 ||
-	    HMAC_Update(ctx, phe->ptr, (int)phe->len) == 0 ||
-	    HMAC_Final(ctx, dgst, &dgst_len) == 0 || dgst_len != 32) {
-		log_debug("%s: HMAC", __func__);
+	if (fido_hmac_sha256(key, npe, phe, dgst) < 0) {
+		log_debug("%s: fido_hmac_sha256", __func__);
 		goto fail;
 	}
-#endif /* OPENSSL_VERSION_NUMBER < 0x10100000L */
 
 	if ((item = cbor_build_bytestring(dgst, 16)) == NULL) {
 		log_debug("%s: cbor_build_bytestring", __func__);
@@ -706,10 +932,8 @@ fail:
 	fido_blob_free(&ph);
 	fido_blob_free(&phe);
 
-#if OPENSSL_VERSION_NUMBER >= 0x10100000L
 	if (ctx != NULL)
-		HMAC_CTX_free(ctx);
-#endif
+		EVP_CIPHER_CTX_free(ctx);
 
 	if (ok < 0) {
 		if (item != NULL) {
@@ -724,9 +948,7 @@ fail:
 cbor_item_t *
 encode_set_pin_auth(const fido_blob_t *key, const fido_blob_t *pin)
 {
-	const EVP_MD	*md = NULL;
 	unsigned char	 dgst[SHA256_DIGEST_LENGTH];
-	unsigned int	 dgst_len;
 	cbor_item_t	*item = NULL;
 	fido_blob_t	*pe = NULL;
 
@@ -738,10 +960,8 @@ encode_set_pin_auth(const fido_blob_t *key, const fido_blob_t *pin)
 		goto fail;
 	}
 
-	if ((md = EVP_sha256()) == NULL || key->len != 32 || HMAC(md, key->ptr,
-	    (int)key->len, pe->ptr, (int)pe->len, dgst, &dgst_len) == NULL ||
-	    dgst_len != SHA256_DIGEST_LENGTH) {
-		log_debug("%s: HMAC", __func__);
+	if (key->len != 32 || fido_hmac_sha256(key, pe, NULL, dgst) < 0) {
+		log_debug("%s: fido_hmac_sha256", __func__);
 		goto fail;
 	}
 
@@ -790,9 +1010,11 @@ encode_hmac_secret_param(const fido_blob_t *ecdh, const es256_pk_t *pk,
 	cbor_item_t		*param = NULL;
 	cbor_item_t		*argv[3];
 	struct cbor_pair	 pair;
+	fido_blob_t		 se; /* salt, encrypted */
 
 	memset(argv, 0, sizeof(argv));
 	memset(&pair, 0, sizeof(pair));
+	memset(&se, 0, sizeof(se));
 
 	if (ecdh == NULL || pk == NULL || hmac_salt->ptr == NULL) {
 		log_debug("%s: ecdh=%p, pk=%p, hmac_salt->ptr=%p", __func__,
@@ -806,10 +1028,15 @@ encode_hmac_secret_param(const fido_blob_t *ecdh, const es256_pk_t *pk,
 		goto fail;
 	}
 
-	/* XXX not pin, but salt */
+	/* saltAuth is computed over the same saltEnc; encrypt only once */
+	if (aes256_cbc_enc(ecdh, hmac_salt, &se) < 0) {
+		log_debug("%s: aes256_cbc_enc", __func__);
+		goto fail;
+	}
+
 	if ((argv[0] = es256_pk_encode(pk)) == NULL ||
-	    (argv[1] = encode_pin_enc(ecdh, hmac_salt)) == NULL ||
-	    (argv[2] = encode_set_pin_auth(ecdh, hmac_salt)) == NULL) {
+	    (argv[1] = cbor_build_bytestring(se.ptr, se.len)) == NULL ||
+	    (argv[2] = encode_pin_auth(ecdh, &se)) == NULL) {
 		log_debug("%s: cbor encode", __func__);
 		goto fail;
 	}
@@ -848,6 +1075,8 @@ fail:
 	if (pair.key != NULL)
 		cbor_decref(&pair.key);
 
+	free(se.ptr);
+
 	return (item);
 }
 
@@ -855,10 +1084,11 @@ int
 decode_fmt(const cbor_item_t *item, char **fmt)
 {
 	char	*type = NULL;
+	int	 r;
 
-	if (cbor_string_copy(item, &type) < 0) {
+	if ((r = cbor_string_copy(item, &type)) < 0) {
 		log_debug("%s: cbor_string_copy", __func__);
-		return (-1);
+		return (r);
 	}
 
 	if (strcmp(type, "packed") && strcmp(type, "fido-u2f")) {
@@ -972,6 +1202,35 @@ get_cose_alg(const cbor_item_t *item, int *cose_alg)
 	return (0);
 }
 
+static int
+decode_attcred_pubkey_fixed(const unsigned char **buf, size_t *len,
+    int cose_alg, fido_attcred_t *attcred)
+{
+	switch (cose_alg) {
+	case COSE_ES256:
+		if (es256_pk_decode_fixed(buf, len,
+		    &attcred->pubkey.es256) < 0)
+			return (-1);
+		break;
+	case COSE_RS256:
+		if (rs256_pk_decode_fixed(buf, len,
+		    &attcred->pubkey.rs256) < 0)
+			return (-1);
+		break;
+	case COSE_EDDSA:
+		if (eddsa_pk_decode_fixed(buf, len,
+		    &attcred->pubkey.eddsa) < 0)
+			return (-1);
+		break;
+	default:
+		return (-1);
+	}
+
+	attcred->type = cose_alg;
+
+	return (0);
+}
+
 static int
 decode_attcred(const unsigned char **buf, size_t *len, int cose_alg,
     fido_attcred_t *attcred)
@@ -1004,6 +1263,15 @@ decode_attcred(const unsigned char **buf, size_t *len, int cose_alg,
 		return (-1);
 	}
 
+	/* canonical encodings are decoded in place; no cbor_load() */
+	if (decode_attcred_pubkey_fixed(buf, len, cose_alg, attcred) == 0)
+		return (0);
+
+	if (cbor_check_limits(*buf, *len) < 0) {
+		log_debug("%s: cbor_check_limits", __func__);
+		goto fail;
+	}
+
 	if ((item = cbor_load(*buf, *len, &cbor)) == NULL) {
 		log_debug("%s: cbor_load", __func__);
 		log_xxd(*buf, *len);
@@ -1058,8 +1326,15 @@ decode_extension(const cbor_item_t *key, const cbor_item_t *val, void *arg)
 	int	*authdata_ext = arg;
 	char	*type = NULL;
 	int	 ok = -1;
+	int	 r;
 
-	if (cbor_string_copy(key, &type) < 0 || strcmp(type, "hmac-secret")) {
+	if ((r = cbor_string_copy(key, &type)) < 0) {
+		log_debug("%s: cbor_string_copy", __func__);
+		ok = r;
+		goto fail;
+	}
+
+	if (strcmp(type, "hmac-secret")) {
 		log_debug("%s: type", __func__);
 		goto fail;
 	}
@@ -1087,11 +1362,17 @@ decode_extensions(const unsigned char **buf, size_t *len, int *authdata_ext)
 	cbor_item_t		*item = NULL;
 	struct cbor_load_result	 cbor;
 	int			 ok = -1;
+	int			 r;
 
 	log_debug("%s: buf=%p, len=%zu", __func__, (const void *)*buf, *len);
 
 	*authdata_ext = 0;
 
+	if (cbor_check_limits(*buf, *len) < 0) {
+		log_debug("%s: cbor_check_limits", __func__);
+		goto fail;
+	}
+
 	if ((item = cbor_load(*buf, *len, &cbor)) == NULL) {
 		log_debug("%s: cbor_load", __func__);
 		log_xxd(*buf, *len);
@@ -1100,12 +1381,17 @@ decode_extensions(const unsigned char **buf, size_t *len, int *authdata_ext)
 
 	if (cbor_isa_map(item) == false ||
 	    cbor_map_is_definite(item) == false ||
-	    cbor_map_size(item) != 1 ||
-	    cbor_map_iter(item, authdata_ext, decode_extension) < 0) {
+	    cbor_map_size(item) != 1) {
 		log_debug("%s: cbor type", __func__);
 		goto fail;
 	}
 
+	if ((r = cbor_map_iter(item, authdata_ext, decode_extension)) < 0) {
+		log_debug("%s: cbor_map_iter", __func__);
+		ok = r;
+		goto fail;
+	}
+
 	*buf += cbor.read;
 	*len -= cbor.read;
 
@@ -1123,8 +1409,15 @@ decode_hmac_secret_aux(const cbor_item_t *key, const cbor_item_t *val, void *arg
 	fido_blob_t	*out = arg;
 	char		*type = NULL;
 	int		 ok = -1;
+	int		 r;
+
+	if ((r = cbor_string_copy(key, &type)) < 0) {
+		log_debug("%s: cbor_string_copy", __func__);
+		ok = r;
+		goto fail;
+	}
 
-	if (cbor_string_copy(key, &type) < 0 || strcmp(type, "hmac-secret")) {
+	if (strcmp(type, "hmac-secret")) {
 		log_debug("%s: type", __func__);
 		goto fail;
 	}
@@ -1142,9 +1435,15 @@ decode_hmac_secret(const unsigned char **buf, size_t *len, fido_blob_t *out)
 	cbor_item_t		*item = NULL;
 	struct cbor_load_result	 cbor;
 	int			 ok = -1;
+	int			 r;
 
 	log_debug("%s: buf=%p, len=%zu", __func__, (const void *)*buf, *len);
 
+	if (cbor_check_limits(*buf, *len) < 0) {
+		log_debug("%s: cbor_check_limits", __func__);
+		goto fail;
+	}
+
 	if ((item = cbor_load(*buf, *len, &cbor)) == NULL) {
 		log_debug("%s: cbor_load", __func__);
 		log_xxd(*buf, *len);
@@ -1153,12 +1452,17 @@ decode_hmac_secret(const unsigned char **buf, size_t *len, fido_blob_t *out)
 
 	if (cbor_isa_map(item) == false ||
 	    cbor_map_is_definite(item) == false ||
-	    cbor_map_size(item) != 1 ||
-	    cbor_map_iter(item, out, decode_hmac_secret_aux) < 0) {
+	    cbor_map_size(item) != 1) {
 		log_debug("%s: cbor type", __func__);
 		goto fail;
 	}
 
+	if ((r = cbor_map_iter(item, out, decode_hmac_secret_aux)) < 0) {
+		log_debug("%s: cbor_map_iter", __func__);
+		ok = r;
+		goto fail;
+	}
+
 	*buf += cbor.read;
 	*len -= cbor.read;
 
@@ -1178,6 +1482,7 @@ decode_cred_authdata(const cbor_item_t *item, int cose_alg,
 	const unsigned char	*buf = NULL;
 	size_t			 len;
 	size_t			 alloc_len;
+	int			 r;
 
 	if (cbor_isa_bytestring(item) == false ||
 	    cbor_bytestring_is_definite(item) == false) {
@@ -1211,9 +1516,9 @@ decode_cred_authdata(const cbor_item_t *item, int cose_alg,
 	}
 
 	if (authdata_ext != NULL) {
-		if ((authdata->flags & CTAP_AUTHDATA_EXT_DATA) != 0 && 
-		    decode_extensions(&buf, &len, authdata_ext) < 0)
-			return (-1);
+		if ((authdata->flags & CTAP_AUTHDATA_EXT_DATA) != 0 &&
+		    (r = decode_extensions(&buf, &len, authdata_ext)) < 0)
+			return (r);
 	}
 
 	/* XXX we should probably ensure that len == 0 at this point */
@@ -1228,6 +1533,7 @@ decode_assert_authdata(const cbor_item_t *item, fido_blob_t *authdata_cbor,
 	const unsigned char	*buf = NULL;
 	size_t			 len;
 	size_t			 alloc_len;
+	int			 r;
 
 	if (cbor_isa_bytestring(item) == false ||
 	    cbor_bytestring_is_definite(item) == false) {
@@ -1257,9 +1563,10 @@ decode_assert_authdata(const cbor_item_t *item, fido_blob_t *authdata_cbor,
 	*authdata_ext = 0;
 	if ((authdata->flags & CTAP_AUTHDATA_EXT_DATA) != 0) {
 		/* XXX semantic leap: extensions -> hmac_secret */
-		if (decode_hmac_secret(&buf, &len, hmac_secret_enc) < 0) {
+		if ((r = decode_hmac_secret(&buf, &len,
+		    hmac_secret_enc)) < 0) {
 			log_debug("%s: decode_hmac_secret", __func__);
-			return (-1);
+			return (r);
 		}
 		*authdata_ext = FIDO_EXT_HMAC_SECRET;
 	}
@@ -1286,9 +1593,13 @@ decode_attstmt_entry(const cbor_item_t *key, const cbor_item_t *val, void *arg)
 	fido_attstmt_t	*attstmt = arg;
 	char		*name = NULL;
 	int		 ok = -1;
+	int		 r;
 
-	if (cbor_string_copy(key, &name) < 0)
+	if ((r = cbor_string_copy(key, &name)) < 0) {
+		log_debug("%s: cbor_string_copy", __func__);
+		ok = r;
 		goto fail;
+	}
 
 	if (!strcmp(name, "alg")) {
 		if (cbor_isa_negint(val) == false ||
@@ -1322,13 +1633,19 @@ fail:
 int
 decode_attstmt(const cbor_item_t *item, fido_attstmt_t *attstmt)
 {
+	int r;
+
 	if (cbor_isa_map(item) == false ||
-	    cbor_map_is_definite(item) == false ||
-	    cbor_map_iter(item, attstmt, decode_attstmt_entry) < 0) {
+	    cbor_map_is_definite(item) == false) {
 		log_debug("%s: cbor type", __func__);
 		return (-1);
 	}
 
+	if ((r = cbor_map_iter(item, attstmt, decode_attstmt_entry)) < 0) {
+		log_debug("%s: cbor_map_iter", __func__);
+		return (r);
+	}
+
 	return (0);
 }
 
@@ -1351,9 +1668,11 @@ decode_cred_id_entry(const cbor_item_t *key, const cbor_item_t *val, void *arg)
 	fido_blob_t	*id = arg;
 	char		*name = NULL;
 	int		 ok = -1;
+	int		 r;
 
-	if (cbor_string_copy(key, &name) < 0) {
+	if ((r = cbor_string_copy(key, &name)) < 0) {
 		log_debug("%s: cbor_string_copy", __func__);
+		ok = r;
 		goto fail;
 	}
 
@@ -1373,13 +1692,19 @@ fail:
 int
 decode_cred_id(const cbor_item_t *item, fido_blob_t *id)
 {
+	int r;
+
 	if (cbor_isa_map(item) == false ||
-	    cbor_map_is_definite(item) == false ||
-	    cbor_map_iter(item, id, decode_cred_id_entry) < 0) {
+	    cbor_map_is_definite(item) == false) {
 		log_debug("%s: cbor type", __func__);
 		return (-1);
 	}
 
+	if ((r = cbor_map_iter(item, id, decode_cred_id_entry)) < 0) {
+		log_debug("%s: cbor_map_iter", __func__);
+		return (r);
+	}
+
 	return (0);
 }
 
@@ -1389,25 +1714,30 @@ decode_user_entry(const cbor_item_t *key, const cbor_item_t *val, void *arg)
 	fido_user_t	*user = arg;
 	char		*name = NULL;
 	int		 ok = -1;
+	int		 r;
 
-	if (cbor_string_copy(key, &name) < 0) {
+	if ((r = cbor_string_copy(key, &name)) < 0) {
 		log_debug("%s: type name", __func__);
+		ok = r;
 		goto fail;
 	}
 
 	if (!strcmp(name, "icon")) {
-		if (cbor_string_copy(val, &user->icon) < 0) {
+		if ((r = cbor_string_copy(val, &user->icon)) < 0) {
 			log_debug("%s: icon", __func__);
+			ok = r;
 			goto fail;
 		}
 	} else if (!strcmp(name, "name")) {
-		if (cbor_string_copy(val, &user->name) < 0) {
+		if ((r = cbor_string_copy(val, &user->name)) < 0) {
 			log_debug("%s: name", __func__);
+			ok = r;
 			goto fail;
 		}
 	} else if (!strcmp(name, "displayName")) {
-		if (cbor_string_copy(val, &user->display_name) < 0) {
+		if ((r = cbor_string_copy(val, &user->display_name)) < 0) {
 			log_debug("%s: display_name", __func__);
+			ok = r;
 			goto fail;
 		}
 	} else if (!strcmp(name, "id")) {
@@ -1427,12 +1757,18 @@ fail:
 int
 decode_user(const cbor_item_t *item, fido_user_t *user)
 {
+	int r;
+
 	if (cbor_isa_map(item) == false ||
-	    cbor_map_is_definite(item) == false ||
-	    cbor_map_iter(item, user, decode_user_entry) < 0) {
+	    cbor_map_is_definite(item) == false) {
 		log_debug("%s: cbor type", __func__);
 		return (-1);
 	}
 
+	if ((r = cbor_map_iter(item, user, decode_user_entry)) < 0) {
+		log_debug("%s: cbor_map_iter", __func__);
+		return (r);
+	}
+
 	return (0);
 }
@@ -41,7 +41,8 @@ parse_makecred_reply(const cbor_item_t *key, const cbor_item_t *val, void *arg)
 }
 
 static int
-fido_dev_make_cred_tx(fido_dev_t *dev, fido_cred_t *cred, const char *pin)
+fido_dev_make_cred_tx(fido_dev_t *dev, fido_cred_t *cred, const char *pin,
+    int *ms)
 {
 	fido_blob_t	 f;
 	fido_blob_t	*ecdh = NULL;
@@ -94,12 +95,13 @@ fido_dev_make_cred_tx(fido_dev_t *dev, fido_cred_t *cred, const char *pin)
 
 	/* pin authentication */
 	if (pin) {
-		if ((r = fido_do_ecdh(dev, &pk, &ecdh)) != FIDO_OK) {
+		if (fido_dev_pin_token_cached(dev, pin) == false &&
+		    (r = fido_do_ecdh(dev, &pk, &ecdh, ms)) != FIDO_OK) {
 			log_debug("%s: fido_do_ecdh", __func__);
 			goto fail;
 		}
 		if ((r = add_cbor_pin_params(dev, &cred->cdh, pk, ecdh, pin,
-		    &argv[7], &argv[8])) != FIDO_OK) {
+		    &argv[7], &argv[8], ms)) != FIDO_OK) {
 			log_debug("%s: add_cbor_pin_params", __func__);
 			goto fail;
 		}
@@ -127,22 +129,57 @@ fail:
 	return (r);
 }
 
+/* Measure the makeCredential request for cred, other than its exclude list. */
 static int
-fido_dev_make_cred_rx(fido_dev_t *dev, fido_cred_t *cred, int ms)
+make_cred_req_len(const fido_cred_t *cred, const char *pin, uint64_t *len)
 {
-	const uint8_t	cmd = CTAP_FRAME_INIT | CTAP_CMD_CBOR;
-	unsigned char	reply[2048];
-	int		reply_len;
-	int		r;
+	cbor_item_t	*argv[7];
+	int		 r;
 
-	fido_cred_reset_rx(cred);
+	memset(argv, 0, sizeof(argv));
 
-	if ((reply_len = rx(dev, cmd, &reply, sizeof(reply), ms)) < 0) {
-		log_debug("%s: rx", __func__);
-		return (FIDO_ERR_RX);
+	if ((argv[0] = fido_blob_encode(&cred->cdh)) == NULL ||
+	    (argv[1] = encode_rp_entity(&cred->rp)) == NULL ||
+	    (argv[2] = encode_user_entity(&cred->user)) == NULL ||
+	    (argv[3] = encode_pubkey_param(cred->type)) == NULL) {
+		log_debug("%s: cbor encode", __func__);
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
 	}
 
-	if ((r = parse_cbor_reply(reply, (size_t)reply_len, cred,
+	if (cred->ext)
+		if ((argv[5] = encode_extensions(cred->ext)) == NULL) {
+			log_debug("%s: encode_extensions", __func__);
+			r = FIDO_ERR_INTERNAL;
+			goto fail;
+		}
+
+	if (cred->rk != FIDO_OPT_OMIT || cred->uv != FIDO_OPT_OMIT)
+		if ((argv[6] = encode_options(cred->rk, cred->uv)) == NULL) {
+			log_debug("%s: encode_options", __func__);
+			r = FIDO_ERR_INTERNAL;
+			goto fail;
+		}
+
+	r = fido_cred_list_req_len(CTAP_CBOR_MAKECRED, argv, 7, pin != NULL,
+	    len);
+fail:
+	for (size_t i = 0; i < 7; i++)
+		if (argv[i])
+			cbor_decref(&argv[i]);
+
+	return (r);
+}
+
+static int
+fido_dev_make_cred_reply(fido_cred_t *cred, const unsigned char *reply,
+    size_t reply_len)
+{
+	int r;
+
+	fido_cred_reset_rx(cred);
+
+	if ((r = parse_cbor_reply(reply, reply_len, cred,
 	    parse_makecred_reply)) != FIDO_OK) {
 		log_debug("%s: parse_makecred_reply", __func__);
 		return (r);
@@ -160,11 +197,29 @@ fido_dev_make_cred_rx(fido_dev_t *dev, fido_cred_t *cred, int ms)
 }
 
 static int
-fido_dev_make_cred_wait(fido_dev_t *dev, fido_cred_t *cred, const char *pin, int ms)
+fido_dev_make_cred_rx(fido_dev_t *dev, fido_cred_t *cred, int *ms)
+{
+	const uint8_t		 cmd = CTAP_FRAME_INIT | CTAP_CMD_CBOR;
+	const unsigned char	*reply;
+	int			 reply_len;
+
+	fido_cred_reset_rx(cred);
+
+	if ((reply_len = rx_msg(dev, cmd, &reply, ms)) < 0) {
+		log_debug("%s: rx", __func__);
+		return (rx_error(ms));
+	}
+
+	return (fido_dev_make_cred_reply(cred, reply, (size_t)reply_len));
+}
+
+static int
+fido_dev_make_cred_wait(fido_dev_t *dev, fido_cred_t *cred, const char *pin,
+    int *ms)
 {
 	int  r;
 
-	if ((r = fido_dev_make_cred_tx(dev, cred, pin)) != FIDO_OK ||
+	if ((r = fido_dev_make_cred_tx(dev, cred, pin, ms)) != FIDO_OK ||
 	    (r = fido_dev_make_cred_rx(dev, cred, ms)) != FIDO_OK)
 		return (r);
 
@@ -174,13 +229,114 @@ fido_dev_make_cred_wait(fido_dev_t *dev, fido_cred_t *cred, const char *pin, int
 int
 fido_dev_make_cred(fido_dev_t *dev, fido_cred_t *cred, const char *pin)
 {
-	if (fido_dev_is_fido2(dev) == false) {
-		if (pin != NULL || cred->rk == FIDO_OPT_TRUE || cred->ext != 0)
-			return (FIDO_ERR_UNSUPPORTED_OPTION);
-		return (u2f_register(dev, cred, -1));
+	fido_blob_array_t	excl;
+	fido_blob_array_t	usable;
+	uint64_t		len;
+	size_t			idx;
+	bool			cached;
+	int			ms = dev->timeout_ms;
+	int			r;
+
+	if (fido_dev_is_fido2(dev) == false &&
+	    (pin != NULL || cred->rk == FIDO_OPT_TRUE || cred->ext != 0))
+		return (FIDO_ERR_UNSUPPORTED_OPTION);
+
+	fido_dev_op_begin(dev);
+
+	if (fido_dev_is_fido2(dev) == false)
+		return (fido_dev_op_end(dev, u2f_register(dev, cred, &ms)));
+
+	/*
+	 * Leave out credentials the device cannot hold. If the rest still
+	 * exceed its limits, find out which of them the device holds, if
+	 * any, and exclude that one alone.
+	 */
+	excl = cred->excl;
+
+	if (fido_dev_cred_list_filter(dev, &excl, &usable, &ms) < 0)
+		return (fido_dev_op_end(dev, FIDO_ERR_INTERNAL));
+
+	cred->excl = usable;
+
+	if (cred->rp.id != NULL && cred->cdh.ptr != NULL && usable.len > 0) {
+		if ((r = make_cred_req_len(cred, pin, &len)) != FIDO_OK)
+			goto fail;
+		if (fido_dev_cred_list_fits(dev, len, &usable, &ms) == false) {
+			if ((r = fido_dev_cred_list_probe(dev, cred->rp.id,
+			    pin, &usable, &idx, &ms)) != FIDO_OK) {
+				log_debug("%s: fido_dev_cred_list_probe",
+				    __func__);
+				goto fail;
+			}
+			/*
+			 * Without a pinAuth, the probes cannot see credentials
+			 * that require user verification, which the device
+			 * would match once it verifies the user itself; do not
+			 * drop the list on their say.
+			 */
+			if (idx == usable.len && pin == NULL &&
+			    cred->uv == FIDO_OPT_TRUE) {
+				log_debug("%s: probe without uv", __func__);
+				r = FIDO_ERR_UNSUPPORTED_OPTION;
+				goto fail;
+			}
+			cred->excl.ptr = idx < usable.len ?
+			    &usable.ptr[idx] : NULL;
+			cred->excl.len = idx < usable.len ? 1 : 0;
+		}
+	}
+
+	cached = fido_dev_pin_session_cached(dev);
+	r = fido_dev_make_cred_wait(dev, cred, pin, &ms);
+	fido_dev_pin_session_check(dev, r);
+
+	if (r != FIDO_OK && cached && fido_dev_pin_session_stale(r)) {
+		log_debug("%s: 0x%x, retrying with a new session", __func__, r);
+		fido_dev_pin_session_reset(dev);
+		r = fido_dev_make_cred_wait(dev, cred, pin, &ms);
+		fido_dev_pin_session_check(dev, r);
+	}
+fail:
+	cred->excl = excl;
+	free(usable.ptr); /* blobs shared with cred->excl */
+
+	return (fido_dev_op_end(dev, r));
+}
+
+static int
+fido_dev_make_cred_step(fido_dev_t *dev, void *arg,
+    const unsigned char *reply, size_t reply_len)
+{
+	(void)dev;
+
+	return (fido_dev_make_cred_reply(arg, reply, reply_len));
+}
+
+int
+fido_dev_make_cred_start(fido_dev_t *dev, fido_cred_t *cred, const char *pin)
+{
+	int ms = 0; /* nothing below may block */
+	int r;
+
+	if (fido_dev_is_fido2(dev) == false)
+		return (FIDO_ERR_UNSUPPORTED_OPTION);
+
+	/* obtaining a pinToken would block; only a kept one can be used */
+	if (pin != NULL && fido_dev_pin_token_cached(dev, pin) == false) {
+		log_debug("%s: pinToken not cached", __func__);
+		return (FIDO_ERR_UNSUPPORTED_OPTION);
+	}
+
+	if ((r = async_begin(dev, fido_dev_make_cred_step, cred)) != FIDO_OK)
+		return (r);
+
+	if ((r = fido_dev_make_cred_tx(dev, cred, pin, &ms)) != FIDO_OK) {
+		log_debug("%s: fido_dev_make_cred_tx", __func__);
+		async_end(dev);
+		return (r);
 	}
 
-	return (fido_dev_make_cred_wait(dev, cred, pin, -1));
+	return (FIDO_OK);
 }
 
 static int
@@ -235,6 +391,11 @@ get_signed_hash_packed(fido_blob_t *dgst, const fido_blob_t *clientdata,
 	SHA256_CTX		 ctx;
 	int			 ok = -1;
 
+	if (cbor_check_limits(authdata_cbor->ptr, authdata_cbor->len) < 0) {
+		log_debug("%s: cbor_check_limits", __func__);
+		goto fail;
+	}
+
 	if ((item = cbor_load(authdata_cbor->ptr, authdata_cbor->len,
 	    &cbor)) == NULL) {
 		log_debug("%s: cbor_load", __func__);
@@ -476,6 +637,46 @@ fido_cred_reset_rx(fido_cred_t *cred)
 	fido_cred_clean_sig(cred);
 }
 
+/*
+ * Prepare dst to receive the reply to the request described by src: the
+ * request parameters are shared with src, and only the reply is owned by
+ * dst. Used to run one request against several devices at once.
+ */
+void
+fido_cred_borrow_tx(fido_cred_t *dst, const fido_cred_t *src)
+{
+	memset(dst, 0, sizeof(*dst));
+
+	dst->cdh = src->cdh;
+	dst->rp = src->rp;
+	dst->user = src->user;
+	dst->excl = src->excl;
+	dst->rk = src->rk;
+	dst->uv = src->uv;
+	dst->ext = src->ext;
+	dst->type = src->type;
+}
+
+void
+fido_cred_move_rx(fido_cred_t *dst, fido_cred_t *src)
+{
+	fido_cred_reset_rx(dst);
+
+	dst->fmt = src->fmt;
+	dst->authdata_ext = src->authdata_ext;
+	dst->authdata_cbor = src->authdata_cbor;
+	dst->authdata = src->authdata;
+	dst->attcred = src->attcred;
+	dst->attstmt = src->attstmt;
+
+	src->fmt = NULL;
+	src->authdata_ext = 0;
+	memset(&src->authdata_cbor, 0, sizeof(src->authdata_cbor));
+	memset(&src->authdata, 0, sizeof(src->authdata));
+	memset(&src->attcred, 0, sizeof(src->attcred));
+	memset(&src->attstmt, 0, sizeof(src->attstmt));
+}
+
 void
 fido_cred_free(fido_cred_t **cred_p)
 {
@@ -506,6 +707,12 @@ fido_cred_set_authdata(fido_cred_t *cred, const unsigned char *ptr, size_t len)
 		goto fail;
 	}
 
+	if (cbor_check_limits(ptr, len) < 0) {
+		log_debug("%s: cbor_check_limits", __func__);
+		r = FIDO_ERR_CBOR_LIMIT;
+		goto fail;
+	}
+
 	if ((item = cbor_load(ptr, len, &cbor)) == NULL) {
 		log_debug("%s: cbor_load", __func__);
 		r = FIDO_ERR_INVALID_ARGUMENT;
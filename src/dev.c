@@ -65,10 +65,8 @@ fail:
 #endif /* _WIN32 */
 
 static int
-fido_dev_open_tx(fido_dev_t *dev, const char *path)
+fido_dev_open_handle(fido_dev_t *dev, const char *path)
 {
-	const uint8_t cmd = CTAP_FRAME_INIT | CTAP_CMD_INIT;
-
 	if (dev->io_handle != NULL) {
 		log_debug("%s: handle=%p", __func__, dev->io_handle);
 		return (FIDO_ERR_INVALID_ARGUMENT);
@@ -79,35 +77,70 @@ fido_dev_open_tx(fido_dev_t *dev, const char *path)
 		return (FIDO_ERR_INVALID_ARGUMENT);
 	}
 
-	if (obtain_nonce(&dev->nonce) < 0) {
-		log_debug("%s: obtain_nonce", __func__);
+	if ((dev->io_handle = dev->io.open(path)) == NULL) {
+		log_debug("%s: dev->io.open", __func__);
 		return (FIDO_ERR_INTERNAL);
 	}
 
-	if ((dev->io_handle = dev->io.open(path)) == NULL) {
-		log_debug("%s: dev->io.open", __func__);
+	free(dev->serial);
+	dev->serial = NULL;
+
+	if (dev->io.open == hid_open) {
+		dev->rx_len = hid_report_in_len(dev->io_handle);
+		dev->tx_len = hid_report_out_len(dev->io_handle);
+		dev->serial = hid_serial(dev->io_handle);
+	} else {
+		dev->rx_len = CTAP_RPT_SIZE;
+		dev->tx_len = CTAP_RPT_SIZE;
+	}
+
+	return (FIDO_OK);
+}
+
+static int
+fido_dev_init_tx(fido_dev_t *dev)
+{
+	const uint8_t cmd = CTAP_FRAME_INIT | CTAP_CMD_INIT;
+
+	if (obtain_nonce(&dev->nonce) < 0) {
+		log_debug("%s: obtain_nonce", __func__);
 		return (FIDO_ERR_INTERNAL);
 	}
 
 	if (tx(dev, cmd, &dev->nonce, sizeof(dev->nonce)) < 0) {
 		log_debug("%s: tx", __func__);
+		return (FIDO_ERR_TX);
+	}
+
+	return (FIDO_OK);
+}
+
+static int
+fido_dev_open_tx(fido_dev_t *dev, const char *path)
+{
+	int r;
+
+	if ((r = fido_dev_open_handle(dev, path)) != FIDO_OK)
+		return (r);
+
+	if ((r = fido_dev_init_tx(dev)) != FIDO_OK) {
 		dev->io.close(dev->io_handle);
 		dev->io_handle = NULL;
-		return (FIDO_ERR_TX);
+		return (r);
 	}
 
 	return (FIDO_OK);
 }
 
 static int
-fido_dev_open_rx(fido_dev_t *dev, int ms)
+fido_dev_open_rx(fido_dev_t *dev, int *ms)
 {
 	const uint8_t	cmd = CTAP_FRAME_INIT | CTAP_CMD_INIT;
 	int		r;
 
 	if ((r = rx(dev, cmd, &dev->attr, sizeof(dev->attr), ms)) < 0) {
 		log_debug("%s: rx", __func__);
-		return (FIDO_ERR_RX);
+		return (rx_error(ms));
 	}
 
 #ifdef FIDO_FUZZ
@@ -125,7 +158,7 @@ fido_dev_open_rx(fido_dev_t *dev, int ms)
 }
 
 static int
-fido_dev_open_wait(fido_dev_t *dev, const char *path, int ms)
+fido_dev_open_wait(fido_dev_t *dev, const char *path, int *ms)
 {
 	int r;
 
@@ -133,13 +166,66 @@ fido_dev_open_wait(fido_dev_t *dev, const char *path, int ms)
 	    (r = fido_dev_open_rx(dev, ms)) != FIDO_OK)
 		return (r);
 
+	if (dev->path == NULL || strcmp(dev->path, path) != 0)
+		fido_dev_hint_reset(dev);
+
+	free(dev->path);
+	if ((dev->path = strdup(path)) == NULL)
+		log_debug("%s: strdup", __func__);
+
+	return (FIDO_OK);
+}
+
+/*
+ * Reopen a device on the channel allocated when it was last opened,
+ * skipping CTAPHID_INIT. Should the authenticator have reclaimed the
+ * channel, the first request fails with ERR_INVALID_CHANNEL and is
+ * replayed on a new one; see rx_preamble().
+ */
+static int
+fido_dev_open_resume(fido_dev_t *dev, const char *path)
+{
+	int r;
+
+	if ((r = fido_dev_open_handle(dev, path)) != FIDO_OK)
+		return (r);
+
+	dev->resumed = true;
+
 	return (FIDO_OK);
 }
 
 int
 fido_dev_open(fido_dev_t *dev, const char *path)
 {
-	return (fido_dev_open_wait(dev, path, -1));
+	int ms = dev->timeout_ms;
+
+	if (dev->resume && dev->path != NULL &&
+	    dev->cid != CTAP_CID_BROADCAST && strcmp(dev->path, path) == 0)
+		return (fido_dev_open_resume(dev, path));
+
+	return (fido_dev_open_wait(dev, path, &ms));
+}
+
+/*
+ * Allocate a new channel on an open device, replacing dev->cid and
+ * dev->attr. The authenticator may have been power cycled, so the PIN
+ * session is dropped.
+ */
+int
+fido_dev_reinit(fido_dev_t *dev, int *ms)
+{
+	int r;
+
+	dev->cid = CTAP_CID_BROADCAST;
+	dev->resumed = false;
+	fido_dev_pin_session_reset(dev);
+
+	if ((r = fido_dev_init_tx(dev)) != FIDO_OK ||
+	    (r = fido_dev_open_rx(dev, ms)) != FIDO_OK)
+		return (r);
+
+	return (FIDO_OK);
 }
 
 int
@@ -148,8 +234,107 @@ fido_dev_close(fido_dev_t *dev)
 	if (dev->io_handle == NULL || dev->io.close == NULL)
 		return (FIDO_ERR_INVALID_ARGUMENT);
 
+	async_end(dev);
 	dev->io.close(dev->io_handle);
 	dev->io_handle = NULL;
+	dev->resumed = false;
+	fido_dev_cbor_info_reset(dev);
+	fido_dev_pin_session_reset(dev);
+
+	return (FIDO_OK);
+}
+
+/*
+ * dev->op records whether an operation that fido_dev_cancel() may abort is
+ * in progress on dev, and whether it has been. As fido_dev_cancel() may be
+ * called from another thread, dev->op is only accessed atomically.
+ */
+#define OP_IDLE		0
+#define OP_RUNNING	1
+#define OP_CANCELLED	2
+
+static long
+op_load(fido_dev_t *dev)
+{
+#if defined(_MSC_VER)
+	return (InterlockedCompareExchange(&dev->op, 0, 0));
+#else
+	return (__atomic_load_n(&dev->op, __ATOMIC_SEQ_CST));
+#endif
+}
+
+static long
+op_swap(fido_dev_t *dev, long v)
+{
+#if defined(_MSC_VER)
+	return (InterlockedExchange(&dev->op, v));
+#else
+	return (__atomic_exchange_n(&dev->op, v, __ATOMIC_SEQ_CST));
+#endif
+}
+
+static bool
+op_replace(fido_dev_t *dev, long from, long to)
+{
+#if defined(_MSC_VER)
+	return (InterlockedCompareExchange(&dev->op, to, from) == from);
+#else
+	return (__atomic_compare_exchange_n(&dev->op, &from, to, false,
+	    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+#endif
+}
+
+/* Begin a cancellable operation on dev. */
+void
+fido_dev_op_begin(fido_dev_t *dev)
+{
+	(void)op_swap(dev, OP_RUNNING);
+}
+
+/*
+ * End the operation begun on dev; r is its outcome, which becomes
+ * FIDO_ERR_KEEPALIVE_CANCEL if the operation failed after it was cancelled.
+ */
+int
+fido_dev_op_end(fido_dev_t *dev, int r)
+{
+	if (op_swap(dev, OP_IDLE) == OP_CANCELLED && r != FIDO_OK) {
+		log_debug("%s: 0x%x, cancelled", __func__, r);
+		return (FIDO_ERR_KEEPALIVE_CANCEL);
+	}
+
+	return (r);
+}
+
+/* Whether the operation in progress on dev has been cancelled. */
+bool
+fido_dev_cancelled(fido_dev_t *dev)
+{
+	return (op_load(dev) == OP_CANCELLED);
+}
+
+/*
+ * Abort the operation in progress on dev; may be called from another
+ * thread. A FIDO2 device answers the pending request with
+ * FIDO_ERR_KEEPALIVE_CANCEL, which also wakes the thread waiting for it;
+ * tx() refuses any further request of the operation. U2F has no such
+ * command; the polling loop notices the cancellation instead.
+ */
+int
+fido_dev_cancel(fido_dev_t *dev)
+{
+	if (dev->io_handle == NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	if (op_replace(dev, OP_RUNNING, OP_CANCELLED) == false) {
+		log_debug("%s: no operation in progress", __func__);
+		return (FIDO_OK);
+	}
+
+	if (fido_dev_is_fido2(dev) && tx_cancel(dev) < 0) {
+		log_debug("%s: tx_cancel", __func__);
+		return (FIDO_ERR_TX);
+	}
 
 	return (FIDO_OK);
 }
@@ -181,6 +366,8 @@ fido_init(int flags)
 {
 	if (flags & FIDO_DEBUG || getenv("FIDO_DEBUG") != NULL)
 		log_init();
+
+	fido_evp_init();
 }
 
 fido_dev_t *
@@ -193,6 +380,9 @@ fido_dev_new(void)
 		return (NULL);
 
 	dev->cid = CTAP_CID_BROADCAST;
+	dev->timeout_ms = -1;
+	dev->rx_len = CTAP_RPT_SIZE;
+	dev->tx_len = CTAP_RPT_SIZE;
 
 	io.open = hid_open;
 	io.close = hid_close;
@@ -216,11 +406,96 @@ fido_dev_free(fido_dev_t **dev_p)
 	if (dev_p == NULL || (dev = *dev_p) == NULL)
 		return;
 
+	async_end(dev);
+	io_buf_free(dev);
+	fido_dev_cbor_info_reset(dev);
+	fido_dev_pin_session_reset(dev);
+	fido_dev_hint_reset(dev);
+	free(dev->info_cache_dir);
+	free(dev->serial);
+	free(dev->path);
 	free(dev);
 
 	*dev_p = NULL;
 }
 
+int
+fido_dev_set_timeout(fido_dev_t *dev, int ms)
+{
+	if (ms < -1)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	dev->timeout_ms = ms;
+
+	return (FIDO_OK);
+}
+
+int
+fido_dev_set_cbor_info_cache(fido_dev_t *dev, const char *dir)
+{
+	char *p = NULL;
+
+	if (dir != NULL && (p = strdup(dir)) == NULL)
+		return (FIDO_ERR_INTERNAL);
+
+	free(dev->info_cache_dir);
+	dev->info_cache_dir = p;
+
+	return (FIDO_OK);
+}
+
+int
+fido_dev_set_cred_hints(fido_dev_t *dev, size_t n)
+{
+	if (n > UINT8_MAX)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	fido_dev_hint_reset(dev);
+	dev->hint_max = n;
+
+	return (FIDO_OK);
+}
+
+int
+fido_dev_set_pin_session(fido_dev_t *dev, bool session)
+{
+	dev->pin_session = session;
+	if (session == false)
+		fido_dev_pin_session_reset(dev);
+
+	return (FIDO_OK);
+}
+
+int
+fido_dev_set_resume(fido_dev_t *dev, bool resume)
+{
+	dev->resume = resume;
+
+	return (FIDO_OK);
+}
+
+int
+fido_dev_set_u2f_poll(fido_dev_t *dev, int min_ms, int max_ms)
+{
+	if (min_ms < 0 || max_ms < 0 || min_ms > 1000 || max_ms > 1000 ||
+	    (min_ms != 0 && max_ms != 0 && min_ms > max_ms))
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	dev->u2f_poll_min = min_ms;
+	dev->u2f_poll_max = max_ms;
+
+	return (FIDO_OK);
+}
+
+int
+fido_dev_set_status_cb(fido_dev_t *dev, fido_dev_status_cb_t *cb, void *arg)
+{
+	dev->status_cb = cb;
+	dev->status_arg = arg;
+
+	return (FIDO_OK);
+}
+
 uint8_t
 fido_dev_protocol(const fido_dev_t *dev)
 {
@@ -0,0 +1,375 @@
+/*
+ * Copyright (c) 2019 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#ifndef _WIN32
+#include <poll.h>
+#endif
+#include <string.h>
+
+#include "fido.h"
+
+/* time granted to a cancelled device to acknowledge the cancellation */
+#define CANCEL_MS	1000
+
+#define OP_IDLE		0 /* nothing outstanding */
+#define OP_ACTIVE	1 /* waiting for the device */
+#define OP_CANCELLED	2 /* cancel sent, awaiting the reply */
+
+struct devset_op {
+	fido_dev_t	*dev;   /* device */
+	void		*obj;   /* per-device reply object */
+	int		 fd;    /* descriptor to poll */
+	int		 state; /* OP_* */
+	int		 ms;    /* time left; -1 = no deadline */
+	bool		 ready; /* descriptor is readable */
+};
+
+typedef int devset_start_t(fido_dev_t *, void *);
+
+fido_dev_set_t *
+fido_dev_set_new(void)
+{
+	return (calloc(1, sizeof(fido_dev_set_t)));
+}
+
+void
+fido_dev_set_free(fido_dev_set_t **set_p)
+{
+	fido_dev_set_t *set;
+
+	if (set_p == NULL || (set = *set_p) == NULL)
+		return;
+
+	for (size_t i = 0; i < set->len; i++) {
+		fido_dev_close(set->dev[i]);
+		fido_dev_free(&set->dev[i]);
+	}
+
+	free(set->dev);
+	free(set);
+
+	*set_p = NULL;
+}
+
+/*
+ * Open every device in devlist and add it to the set. Devices that cannot
+ * be opened are skipped.
+ */
+int
+fido_dev_set_open(fido_dev_set_t *set, const fido_dev_info_t *devlist,
+    size_t n)
+{
+	fido_dev_t	 *dev = NULL;
+	fido_dev_t	**ptr;
+	size_t		  opened = 0;
+	int		  r = FIDO_ERR_INVALID_ARGUMENT;
+
+	for (size_t i = 0; i < n; i++) {
+		if ((dev = fido_dev_new()) == NULL)
+			return (FIDO_ERR_INTERNAL);
+
+		if ((r = fido_dev_open(dev, devlist[i].path)) != FIDO_OK) {
+			log_debug("%s: fido_dev_open %s", __func__,
+			    devlist[i].path);
+			fido_dev_free(&dev);
+			continue;
+		}
+
+		if ((ptr = recallocarray(set->dev, set->len, set->len + 1,
+		    sizeof(*ptr))) == NULL) {
+			fido_dev_close(dev);
+			fido_dev_free(&dev);
+			return (FIDO_ERR_INTERNAL);
+		}
+
+		set->dev = ptr;
+		set->dev[set->len++] = dev;
+		opened++;
+	}
+
+	return (opened > 0 ? FIDO_OK : r);
+}
+
+#ifndef _WIN32
+static int
+devset_wait(struct devset_op *op, size_t n, int ms)
+{
+	struct pollfd	*pfd;
+	int		 r;
+
+	if ((pfd = calloc(n, sizeof(*pfd))) == NULL)
+		return (-1);
+
+	for (size_t i = 0; i < n; i++) {
+		pfd[i].fd = op[i].state != OP_IDLE ? op[i].fd : -1;
+		pfd[i].events = POLLIN;
+	}
+
+	if ((r = poll(pfd, (nfds_t)n, ms)) < 0) {
+		log_debug("%s: poll", __func__);
+		free(pfd);
+		return (-1);
+	}
+
+	for (size_t i = 0; i < n; i++)
+		op[i].ready = pfd[i].revents & (POLLIN|POLLERR|POLLHUP);
+
+	free(pfd);
+
+	return (0);
+}
+#else
+static int
+devset_wait(struct devset_op *op, size_t n, int ms)
+{
+	(void)op;
+	(void)n;
+	(void)ms;
+
+	return (-1); /* no pollable descriptors */
+}
+#endif /* !_WIN32 */
+
+static void
+devset_cancel(struct devset_op *op)
+{
+	if (fido_dev_cancel(op->dev) != FIDO_OK) {
+		log_debug("%s: fido_dev_cancel", __func__);
+		async_end(op->dev);
+		op->state = OP_IDLE;
+		return;
+	}
+
+	op->state = OP_CANCELLED;
+	op->ms = CANCEL_MS;
+}
+
+static bool
+devset_pending(const struct devset_op *op, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		if (op[i].state != OP_IDLE)
+			return (true);
+
+	return (false);
+}
+
+/*
+ * Advance a device whose descriptor is readable, or whose time is up.
+ * Returns the operation's result once it completes, FIDO_ERR_IN_PROGRESS
+ * otherwise.
+ */
+static int
+devset_step(struct devset_op *op)
+{
+	int r = FIDO_ERR_IN_PROGRESS;
+
+	if (op->ready &&
+	    (r = fido_dev_step(op->dev)) != FIDO_ERR_IN_PROGRESS) {
+		if (op->state == OP_CANCELLED)
+			r = FIDO_ERR_KEEPALIVE_CANCEL;
+		op->state = OP_IDLE;
+		return (r);
+	}
+
+	if (op->ms == 0) {
+		if (op->state == OP_ACTIVE) {
+			devset_cancel(op);
+			return (FIDO_ERR_USER_ACTION_TIMEOUT);
+		}
+		log_debug("%s: cancel not acknowledged", __func__);
+		async_end(op->dev);
+		op->state = OP_IDLE;
+	}
+
+	return (r);
+}
+
+/*
+ * Start the same operation on every device in the set and wait for the
+ * first one to complete successfully; the others are then cancelled. On
+ * success, *idx is the index of the winning device. If no device succeeds,
+ * the last error seen is returned.
+ */
+static int
+devset_run(fido_dev_set_t *set, devset_start_t *start, unsigned char *obj,
+    size_t objsiz, size_t *idx)
+{
+	struct devset_op	*op = NULL;
+	struct timespec		 ts;
+	int			 ms;
+	int			 r;
+	int			 last = FIDO_ERR_INVALID_ARGUMENT;
+	bool			 won = false;
+
+	if ((op = calloc(set->len, sizeof(*op))) == NULL)
+		return (FIDO_ERR_INTERNAL);
+
+	for (size_t i = 0; i < set->len; i++) {
+		op[i].dev = set->dev[i];
+		op[i].obj = obj + i * objsiz;
+		if ((op[i].fd = fido_dev_fd(op[i].dev)) < 0) {
+			log_debug("%s: no descriptor for %zu", __func__, i);
+			last = FIDO_ERR_UNSUPPORTED_OPTION;
+			continue;
+		}
+		if ((r = start(op[i].dev, op[i].obj)) != FIDO_OK) {
+			log_debug("%s: start %zu", __func__, i);
+			last = r;
+			continue;
+		}
+		op[i].state = OP_ACTIVE;
+		op[i].ms = op[i].dev->timeout_ms;
+	}
+
+	while (devset_pending(op, set->len)) {
+		ms = -1;
+		for (size_t i = 0; i < set->len; i++)
+			if (op[i].state != OP_IDLE && op[i].ms >= 0 &&
+			    (ms < 0 || op[i].ms < ms))
+				ms = op[i].ms;
+
+		if (fido_time_now(&ts) != 0 ||
+		    devset_wait(op, set->len, ms) < 0) {
+			log_debug("%s: wait", __func__);
+			for (size_t i = 0; i < set->len; i++)
+				if (op[i].state != OP_IDLE)
+					async_end(op[i].dev);
+			last = FIDO_ERR_INTERNAL;
+			break;
+		}
+
+		for (size_t i = 0; i < set->len; i++) {
+			if (op[i].state == OP_IDLE)
+				continue;
+			if (fido_time_delta(&ts, &op[i].ms) != 0)
+				op[i].ms = 0;
+			if (op[i].state == OP_CANCELLED) {
+				devset_step(&op[i]);
+				continue;
+			}
+			if ((r = devset_step(&op[i])) == FIDO_OK && !won) {
+				won = true;
+				*idx = i;
+			} else if (r != FIDO_ERR_IN_PROGRESS && r != FIDO_OK)
+				last = r;
+		}
+
+		if (won)
+			for (size_t i = 0; i < set->len; i++)
+				if (op[i].state == OP_ACTIVE)
+					devset_cancel(&op[i]);
+	}
+
+	free(op);
+
+	return (won ? FIDO_OK : last);
+}
+
+static int
+devset_get_assert_start(fido_dev_t *dev, void *assert)
+{
+	return (fido_dev_get_assert_start(dev, assert, NULL));
+}
+
+static int
+devset_make_cred_start(fido_dev_t *dev, void *cred)
+{
+	return (fido_dev_make_cred_start(dev, cred, NULL));
+}
+
+int
+fido_dev_set_get_assert(fido_dev_set_t *set, fido_assert_t *assert,
+    const char *pin, size_t *idx)
+{
+	fido_assert_t	*a;
+	size_t		 winner = 0;
+	int		 r;
+
+	if (set->len == 0)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	/*
+	 * A PIN is specific to one authenticator; sending it to every device
+	 * in the set would disclose it to all of them and burn their retries.
+	 */
+	if (pin != NULL)
+		return (FIDO_ERR_UNSUPPORTED_OPTION);
+
+	if ((a = calloc(set->len, sizeof(*a))) == NULL)
+		return (FIDO_ERR_INTERNAL);
+
+	for (size_t i = 0; i < set->len; i++)
+		fido_assert_borrow_tx(&a[i], assert);
+
+	if ((r = devset_run(set, devset_get_assert_start, (unsigned char *)a,
+	    sizeof(*a), &winner)) == FIDO_OK) {
+		fido_assert_move_rx(assert, &a[winner]);
+		if (idx != NULL)
+			*idx = winner;
+	}
+
+	for (size_t i = 0; i < set->len; i++)
+		fido_assert_reset_rx(&a[i]);
+
+	free(a);
+
+	return (r);
+}
+
+int
+fido_dev_set_make_cred(fido_dev_set_t *set, fido_cred_t *cred,
+    const char *pin, size_t *idx)
+{
+	fido_cred_t	*c;
+	size_t		 winner = 0;
+	int		 r;
+
+	if (set->len == 0)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	/*
+	 * A PIN is specific to one authenticator; sending it to every device
+	 * in the set would disclose it to all of them and burn their retries.
+	 */
+	if (pin != NULL)
+		return (FIDO_ERR_UNSUPPORTED_OPTION);
+
+	if ((c = calloc(set->len, sizeof(*c))) == NULL)
+		return (FIDO_ERR_INTERNAL);
+
+	for (size_t i = 0; i < set->len; i++)
+		fido_cred_borrow_tx(&c[i], cred);
+
+	if ((r = devset_run(set, devset_make_cred_start, (unsigned char *)c,
+	    sizeof(*c), &winner)) == FIDO_OK) {
+		fido_cred_move_rx(cred, &c[winner]);
+		if (idx != NULL)
+			*idx = winner;
+	}
+
+	for (size_t i = 0; i < set->len; i++)
+		fido_cred_reset_rx(&c[i]);
+
+	free(c);
+
+	return (r);
+}
+
+size_t
+fido_dev_set_len(const fido_dev_set_t *set)
+{
+	return (set->len);
+}
+
+fido_dev_t *
+fido_dev_set_ptr(const fido_dev_set_t *set, size_t idx)
+{
+	if (idx >= set->len)
+		return (NULL);
+
+	return (set->dev[idx]);
+}
@@ -7,6 +7,8 @@
 #include <openssl/evp.h>
 #include <openssl/sha.h>
 
+#include <string.h>
+
 #include "fido.h"
 #include "fido/es256.h"
 
@@ -52,7 +54,8 @@ do_ecdh(const es256_sk_t *sk, const es256_pk_t *pk, fido_blob_t **ecdh)
 	/* use sha256 as a kdf on the resulting secret */
 	(*ecdh)->len = SHA256_DIGEST_LENGTH;
 	if (((*ecdh)->ptr = calloc(1, (*ecdh)->len)) == NULL ||
-	    SHA256(secret->ptr, secret->len, (*ecdh)->ptr) != (*ecdh)->ptr) {
+	    EVP_Digest(secret->ptr, secret->len, (*ecdh)->ptr, NULL,
+	    fido_evp_sha256(), NULL) == 0) {
 		log_debug("%s: sha256", __func__);
 		goto fail;
 	}
@@ -73,30 +76,105 @@ fail:
 	return (ok);
 }
 
+void
+fido_dev_ecdh_reset(fido_dev_t *dev)
+{
+	if (dev->ecdh == NULL)
+		return;
+
+	explicit_bzero(dev->ecdh, sizeof(*dev->ecdh));
+	dev->ecdh = NULL; /* lives in dev->pin_mem */
+}
+
+/*
+ * In session mode (see pin.c), the key agreement with the authenticator is
+ * done once and its result reused; fido_do_ecdh() then hands out copies of
+ * our public key and of the shared secret.
+ */
+static int
+ecdh_cache_get(const fido_dev_t *dev, es256_pk_t **pk, fido_blob_t **ecdh)
+{
+	if (dev->pin_session == false || dev->ecdh == NULL)
+		return (-1);
+
+	if ((*pk = es256_pk_new()) == NULL ||
+	    (*ecdh = fido_blob_new()) == NULL ||
+	    fido_blob_set(*ecdh, dev->ecdh->secret,
+	    sizeof(dev->ecdh->secret)) < 0) {
+		es256_pk_free(pk);
+		fido_blob_free(ecdh);
+		return (-1);
+	}
+
+	memcpy(*pk, &dev->ecdh->pk, sizeof(**pk));
+
+	return (0);
+}
+
+/* Whether fido_do_ecdh() can be served without talking to dev. */
+bool
+fido_dev_ecdh_cached(const fido_dev_t *dev)
+{
+	return (dev->pin_session && dev->ecdh != NULL);
+}
+
+static void
+ecdh_cache_put(fido_dev_t *dev, const es256_pk_t *pk, const fido_blob_t *ecdh)
+{
+	fido_pin_mem_t		*pm;
+	fido_ecdh_cache_t	*ec;
+
+	fido_dev_ecdh_reset(dev);
+
+	if (dev->pin_session == false || ecdh->len != sizeof(ec->secret) ||
+	    (pm = fido_dev_pin_mem(dev)) == NULL)
+		return;
+
+	ec = &pm->ecdh;
+	memcpy(&ec->pk, pk, sizeof(ec->pk));
+	memcpy(ec->secret, ecdh->ptr, sizeof(ec->secret));
+	dev->ecdh = ec;
+}
+
 int
-fido_do_ecdh(fido_dev_t *dev, es256_pk_t **pk, fido_blob_t **ecdh)
+fido_do_ecdh(fido_dev_t *dev, es256_pk_t **pk, fido_blob_t **ecdh, int *ms)
 {
 	es256_sk_t	*sk = NULL; /* our private key */
 	es256_pk_t	*ak = NULL; /* authenticator's public key */
+	int		 kg;
 	int		 r;
 
 	*pk = NULL; /* our public key; returned */
 	*ecdh = NULL; /* shared ecdh secret; returned */
 
+	if (ecdh_cache_get(dev, pk, ecdh) == 0)
+		return (FIDO_OK);
+
 	if ((sk = es256_sk_new()) == NULL || (*pk = es256_pk_new()) == NULL) {
 		r = FIDO_ERR_INTERNAL;
 		goto fail;
 	}
 
-	if (es256_sk_create(sk) < 0 || es256_derive_pk(sk, *pk) < 0) {
-		log_debug("%s: es256_derive_pk", __func__);
+	if ((ak = es256_pk_new()) == NULL ||
+	    fido_dev_authkey_tx(dev) != FIDO_OK) {
+		log_debug("%s: fido_dev_authkey_tx", __func__);
 		r = FIDO_ERR_INTERNAL;
 		goto fail;
 	}
 
-	if ((ak = es256_pk_new()) == NULL ||
-	    fido_dev_authkey(dev, ak) != FIDO_OK) {
-		log_debug("%s: fido_dev_authkey", __func__);
+	/*
+	 * Generate our key pair while the authenticator prepares its reply,
+	 * which is read regardless so that it does not linger on the channel.
+	 */
+	kg = es256_keypair_create(sk, *pk);
+
+	if ((r = fido_dev_authkey_rx(dev, ak, ms)) != FIDO_OK) {
+		log_debug("%s: fido_dev_authkey_rx", __func__);
+		goto fail;
+	}
+
+	if (kg < 0) {
+		log_debug("%s: es256_keypair_create", __func__);
 		r = FIDO_ERR_INTERNAL;
 		goto fail;
 	}
@@ -107,6 +185,8 @@ fido_do_ecdh(fido_dev_t *dev, es256_pk_t **pk, fido_blob_t **ecdh)
 		goto fail;
 	}
 
+	ecdh_cache_put(dev, *pk, *ecdh);
+
 	r = FIDO_OK;
 fail:
 	es256_sk_free(&sk);
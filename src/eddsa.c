@@ -110,6 +110,34 @@ eddsa_pk_decode(const cbor_item_t *item, eddsa_pk_t *k)
 	return (0);
 }
 
+/*
+ * Canonical COSE_Key encoding of an EdDSA public key, as emitted by
+ * authenticators: {1: 1, 3: -8, -1: 6, -2: x}.
+ */
+static const unsigned char cose_eddsa_x[] = {
+	0xa4, 0x01, 0x01, 0x03, 0x27, 0x20, 0x06, 0x21, 0x58, 0x20,
+};
+
+/*
+ * Decode a COSE_Key in canonical form directly from buf. If the encoding
+ * differs in any way, buf is left untouched and -1 is returned so that the
+ * caller may fall back to cbor_load() and eddsa_pk_decode().
+ */
+int
+eddsa_pk_decode_fixed(const unsigned char **buf, size_t *len, eddsa_pk_t *k)
+{
+	if (*len < EDDSA_PK_COSE_LEN ||
+	    memcmp(*buf, cose_eddsa_x, sizeof(cose_eddsa_x)) != 0)
+		return (-1);
+
+	memcpy(&k->x, *buf + sizeof(cose_eddsa_x), sizeof(k->x));
+
+	*buf += EDDSA_PK_COSE_LEN;
+	*len -= EDDSA_PK_COSE_LEN;
+
+	return (0);
+}
+
 eddsa_pk_t *
 eddsa_pk_new(void)
 {
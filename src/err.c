@@ -116,6 +116,12 @@ fido_strerr(int n)
 		return "FIDO_ERR_USER_PRESENCE_REQUIRED";
 	case FIDO_ERR_INTERNAL:
 		return "FIDO_ERR_INTERNAL";
+	case FIDO_ERR_CBOR_LIMIT:
+		return "FIDO_ERR_CBOR_LIMIT";
+	case FIDO_ERR_RX_INVALID_UTF8:
+		return "FIDO_ERR_RX_INVALID_UTF8";
+	case FIDO_ERR_IN_PROGRESS:
+		return "FIDO_ERR_IN_PROGRESS";
 	default:
 		return "FIDO_ERR_UNKNOWN";
 	}
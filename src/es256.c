@@ -60,6 +60,62 @@ es256_pk_decode(const cbor_item_t *item, es256_pk_t *k)
 	return (0);
 }
 
+/*
+ * Canonical COSE_Key encoding of an ES256 public key, as emitted by
+ * authenticators: {1: 2, 3: -7, -1: 1, -2: x, -3: y}.
+ */
+static const unsigned char cose_es256_x[] = {
+	0xa5, 0x01, 0x02, 0x03, 0x26, 0x20, 0x01, 0x21, 0x58, 0x20,
+};
+
+static const unsigned char cose_es256_y[] = {
+	0x22, 0x58, 0x20,
+};
+
+/*
+ * Decode a COSE_Key in canonical form directly from buf. If the encoding
+ * differs in any way, buf is left untouched and -1 is returned so that the
+ * caller may fall back to cbor_load() and es256_pk_decode().
+ */
+int
+es256_pk_decode_fixed(const unsigned char **buf, size_t *len, es256_pk_t *k)
+{
+	const unsigned char *p = *buf;
+
+	if (*len < ES256_PK_COSE_LEN ||
+	    memcmp(p, cose_es256_x, sizeof(cose_es256_x)) != 0 ||
+	    memcmp(p + sizeof(cose_es256_x) + sizeof(k->x), cose_es256_y,
+	    sizeof(cose_es256_y)) != 0)
+		return (-1);
+
+	p += sizeof(cose_es256_x);
+	memcpy(&k->x, p, sizeof(k->x));
+	p += sizeof(k->x) + sizeof(cose_es256_y);
+	memcpy(&k->y, p, sizeof(k->y));
+
+	*buf += ES256_PK_COSE_LEN;
+	*len -= ES256_PK_COSE_LEN;
+
+	return (0);
+}
+
+int
+es256_pk_encode_fixed(const es256_pk_t *pk, unsigned char *ptr, size_t len)
+{
+	if (len < ES256_PK_COSE_LEN)
+		return (-1);
+
+	memcpy(ptr, cose_es256_x, sizeof(cose_es256_x));
+	ptr += sizeof(cose_es256_x);
+	memcpy(ptr, pk->x, sizeof(pk->x));
+	ptr += sizeof(pk->x);
+	memcpy(ptr, cose_es256_y, sizeof(cose_es256_y));
+	ptr += sizeof(cose_es256_y);
+	memcpy(ptr, pk->y, sizeof(pk->y));
+
+	return (0);
+}
+
 cbor_item_t *
 es256_pk_encode(const es256_pk_t *pk)
 {
@@ -237,6 +293,49 @@ fail:
 	return (ok);
 }
 
+/*
+ * Generate a key pair in one go, sparing es256_sk_create()'s parameter
+ * generation and es256_derive_pk()'s point multiplication.
+ */
+int
+es256_keypair_create(es256_sk_t *sk, es256_pk_t *pk)
+{
+	EC_KEY		*ec = NULL;
+	const BIGNUM	*d;
+	const int	 nid = NID_X9_62_prime256v1;
+	int		 n;
+	int		 ok = -1;
+
+	if ((ec = EC_KEY_new_by_curve_name(nid)) == NULL ||
+	    EC_KEY_generate_key(ec) == 0) {
+		log_debug("%s: EC_KEY_generate_key", __func__);
+		goto fail;
+	}
+
+	memset(sk->d, 0, sizeof(sk->d));
+
+	if ((d = EC_KEY_get0_private_key(ec)) == NULL ||
+	    (n = BN_num_bytes(d)) < 0 || (size_t)n > sizeof(sk->d) ||
+	    BN_bn2bin(d, sk->d + sizeof(sk->d) - (size_t)n) != n) {
+		log_debug("%s: EC_KEY_get0_private_key", __func__);
+		goto fail;
+	}
+
+	if (es256_pk_from_EC_KEY(pk, ec) != FIDO_OK) {
+		log_debug("%s: es256_pk_from_EC_KEY", __func__);
+		goto fail;
+	}
+
+	ok = 0;
+fail:
+	if (ec != NULL)
+		EC_KEY_free(ec);
+	if (ok < 0)
+		explicit_bzero(sk->d, sizeof(sk->d));
+
+	return (ok);
+}
+
 EVP_PKEY *
 es256_pk_to_EVP_PKEY(const es256_pk_t *k)
 {
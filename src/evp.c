@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2019 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/sha.h>
+
+#include "fido.h"
+
+/*
+ * Algorithms used on every PIN and hmac-secret operation. With OpenSSL 3,
+ * EVP_aes_256_cbc() and EVP_sha256() stand for implicit fetches, each of
+ * which goes through the provider's locks; fido_init() fetches them once
+ * instead. Without fido_init(), or with older versions of OpenSSL, the
+ * built-in objects are used.
+ */
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+static EVP_CIPHER	*evp_aes256_cbc;
+static EVP_MD		*evp_sha256;
+#endif
+
+void
+fido_evp_init(void)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	if (evp_aes256_cbc == NULL &&
+	    (evp_aes256_cbc = EVP_CIPHER_fetch(NULL, "AES-256-CBC",
+	    NULL)) == NULL)
+		log_debug("%s: EVP_CIPHER_fetch", __func__);
+	if (evp_sha256 == NULL &&
+	    (evp_sha256 = EVP_MD_fetch(NULL, "SHA256", NULL)) == NULL)
+		log_debug("%s: EVP_MD_fetch", __func__);
+#endif /* OPENSSL_VERSION_NUMBER >= 0x30000000L */
+}
+
+const EVP_CIPHER *
+fido_evp_aes256_cbc(void)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	if (evp_aes256_cbc != NULL)
+		return (evp_aes256_cbc);
+#endif
+	return (EVP_aes_256_cbc());
+}
+
+const EVP_MD *
+fido_evp_sha256(void)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	if (evp_sha256 != NULL)
+		return (evp_sha256);
+#endif
+	return (EVP_sha256());
+}
+
+/*
+ * HMAC-SHA-256 of d1 and, if not NULL, d2. Unlike HMAC(), an HMAC_CTX
+ * initialised with a fetched digest involves no further algorithm lookup.
+ */
+int
+fido_hmac_sha256(const fido_blob_t *key, const fido_blob_t *d1,
+    const fido_blob_t *d2, unsigned char *dgst)
+{
+	unsigned int	 dgst_len;
+	int		 ok = -1;
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+	HMAC_CTX	 ctx;
+	HMAC_CTX	*hctx = &ctx;
+
+	HMAC_CTX_init(&ctx);
+#else
+	HMAC_CTX	*hctx = NULL;
+
+	if ((hctx = HMAC_CTX_new()) == NULL)
+		return (-1);
+#endif /* OPENSSL_VERSION_NUMBER < 0x10100000L */
+
+	if (key->len > INT_MAX || HMAC_Init_ex(hctx, key->ptr, (int)key->len,
+	    fido_evp_sha256(), NULL) == 0 ||
+	    HMAC_Update(hctx, d1->ptr, d1->len) == 0 ||
+	    (d2 != NULL && HMAC_Update(hctx, d2->ptr, d2->len) == 0) ||
+	    HMAC_Final(hctx, dgst, &dgst_len) == 0 ||
+	    dgst_len != SHA256_DIGEST_LENGTH) {
+		log_debug("%s: HMAC", __func__);
+		goto fail;
+	}
+
+	ok = 0;
+fail:
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+	HMAC_CTX_cleanup(&ctx);
+#else
+	HMAC_CTX_free(hctx);
+#endif
+
+	return (ok);
+}
@@ -18,6 +18,8 @@
 		fido_assert_count;
 		fido_assert_flags;
 		fido_assert_free;
+		fido_assert_hmac_secret2_len;
+		fido_assert_hmac_secret2_ptr;
 		fido_assert_hmac_secret_len;
 		fido_assert_hmac_secret_ptr;
 		fido_assert_id_len;
@@ -29,6 +31,7 @@
 		fido_assert_set_count;
 		fido_assert_set_extensions;
 		fido_assert_set_hmac_salt;
+		fido_assert_set_hmac_salt2;
 		fido_assert_set_options;
 		fido_assert_set_rp;
 		fido_assert_set_sig;
@@ -47,6 +50,8 @@
 		fido_cbor_info_extensions_len;
 		fido_cbor_info_extensions_ptr;
 		fido_cbor_info_free;
+		fido_cbor_info_maxcredcntlst;
+		fido_cbor_info_maxcredidlen;
 		fido_cbor_info_maxmsgsiz;
 		fido_cbor_info_new;
 		fido_cbor_info_options_len;
@@ -56,6 +61,7 @@
 		fido_cbor_info_protocols_ptr;
 		fido_cbor_info_versions_len;
 		fido_cbor_info_versions_ptr;
+		fido_cbor_set_limits;
 		fido_cred_authdata_len;
 		fido_cred_authdata_ptr;
 		fido_cred_clientdata_hash_len;
@@ -89,13 +95,17 @@
 		fido_cred_x5c_len;
 		fido_cred_x5c_ptr;
 		fido_dev_build;
+		fido_dev_cancel;
 		fido_dev_close;
+		fido_dev_fd;
 		fido_dev_flags;
 		fido_dev_force_fido2;
 		fido_dev_force_u2f;
 		fido_dev_free;
 		fido_dev_get_assert;
+		fido_dev_get_assert_start;
 		fido_dev_get_cbor_info;
+		fido_dev_get_cbor_info_start;
 		fido_dev_get_retry_count;
 		fido_dev_info_free;
 		fido_dev_info_manifest;
@@ -109,13 +119,38 @@
 		fido_dev_is_fido2;
 		fido_dev_major;
 		fido_dev_make_cred;
+		fido_dev_make_cred_start;
+		fido_dev_maxmsgsiz;
 		fido_dev_minor;
 		fido_dev_new;
 		fido_dev_open;
+		fido_dev_option;
 		fido_dev_protocol;
+		fido_dev_registry_fd;
+		fido_dev_registry_free;
+		fido_dev_registry_len;
+		fido_dev_registry_new;
+		fido_dev_registry_open;
+		fido_dev_registry_ptr;
+		fido_dev_registry_update;
 		fido_dev_reset;
+		fido_dev_set_cbor_info_cache;
+		fido_dev_set_cred_hints;
+		fido_dev_set_free;
+		fido_dev_set_get_assert;
 		fido_dev_set_io_functions;
+		fido_dev_set_len;
+		fido_dev_set_make_cred;
+		fido_dev_set_new;
+		fido_dev_set_open;
 		fido_dev_set_pin;
+		fido_dev_set_pin_session;
+		fido_dev_set_ptr;
+		fido_dev_set_resume;
+		fido_dev_set_status_cb;
+		fido_dev_set_timeout;
+		fido_dev_set_u2f_poll;
+		fido_dev_step;
 		fido_init;
 		fido_strerr;
 		rs256_pk_free;
@@ -9,7 +9,21 @@
 
 /* aes256 */
 int aes256_cbc_dec(const fido_blob_t *, const fido_blob_t *, fido_blob_t *);
+int aes256_cbc_dec_ctx(EVP_CIPHER_CTX *, const fido_blob_t *,
+    const fido_blob_t *, fido_blob_t *);
 int aes256_cbc_enc(const fido_blob_t *, const fido_blob_t *, fido_blob_t *);
+int aes256_cbc_enc_ctx(EVP_CIPHER_CTX *, const fido_blob_t *,
+    const fido_blob_t *, fido_blob_t *);
+
+/* es256 */
+int es256_keypair_create(es256_sk_t *, es256_pk_t *);
+
+/* evp */
+const EVP_CIPHER *fido_evp_aes256_cbc(void);
+const EVP_MD *fido_evp_sha256(void);
+int fido_hmac_sha256(const fido_blob_t *, const fido_blob_t *,
+    const fido_blob_t *, unsigned char *);
+void fido_evp_init(void);
 
 /* cbor encoding functions */
 cbor_item_t *encode_assert_options(fido_opt_t, fido_opt_t);
@@ -45,6 +59,16 @@ int es256_pk_decode(const cbor_item_t *, es256_pk_t *);
 int rs256_pk_decode(const cbor_item_t *, rs256_pk_t *);
 int eddsa_pk_decode(const cbor_item_t *, eddsa_pk_t *);
 
+/* fixed-layout cose key codecs */
+#define ES256_PK_COSE_LEN	77
+#define RS256_PK_COSE_LEN	272
+#define EDDSA_PK_COSE_LEN	42
+
+int es256_pk_decode_fixed(const unsigned char **, size_t *, es256_pk_t *);
+int es256_pk_encode_fixed(const es256_pk_t *, unsigned char *, size_t);
+int rs256_pk_decode_fixed(const unsigned char **, size_t *, rs256_pk_t *);
+int eddsa_pk_decode_fixed(const unsigned char **, size_t *, eddsa_pk_t *);
+
 /* auxiliary cbor routines */
 int cbor_add_bool(cbor_item_t *, const char *, fido_opt_t);
 int cbor_add_bytestring(cbor_item_t *, const char *, const unsigned char *,
@@ -54,13 +78,14 @@ int cbor_array_iter(const cbor_item_t *, void *, int(*)(const cbor_item_t *,
     void *));
 int cbor_build_frame(uint8_t, cbor_item_t *[], size_t, fido_blob_t *);
 int cbor_bytestring_copy(const cbor_item_t *, unsigned char **, size_t *);
+int cbor_check_limits(const unsigned char *, size_t);
 int cbor_map_iter(const cbor_item_t *, void *, int(*)(const cbor_item_t *,
     const cbor_item_t *, void *));
 int cbor_string_copy(const cbor_item_t *, char **);
 int parse_cbor_reply(const unsigned char *, size_t, void *,
     int(*)(const cbor_item_t *, const cbor_item_t *, void *));
 int add_cbor_pin_params(fido_dev_t *, const fido_blob_t *, const es256_pk_t *,
-    const fido_blob_t *,const char *, cbor_item_t **, cbor_item_t **);
+    const fido_blob_t *,const char *, cbor_item_t **, cbor_item_t **, int *);
 
 /* buf */
 int buf_read(const unsigned char **, size_t *, void *, size_t);
@@ -69,12 +94,59 @@ int buf_write(unsigned char **, size_t *, const void *, size_t);
 /* hid i/o */
 void *hid_open(const char *);
 void  hid_close(void *);
+int   hid_fd(void *);
 int   hid_read(void *, unsigned char *, size_t, int);
 int   hid_write(void *, const unsigned char *, size_t);
+size_t hid_report_in_len(void *);
+size_t hid_report_out_len(void *);
+char *hid_serial(void *);
+
+/* hid hotplug */
+void *hid_monitor_open(void);
+void  hid_monitor_close(void *);
+int   hid_monitor_fd(void *);
+int   hid_monitor_next(void *, int *, fido_dev_info_t *);
 
 /* generic i/o */
-int rx(fido_dev_t *, uint8_t, void *, size_t, int);
+int rx(fido_dev_t *, uint8_t, void *, size_t, int *);
+int rx_error(const int *);
+int rx_msg(fido_dev_t *, uint8_t, const unsigned char **, int *);
+int rx_step(fido_dev_t *, int, const unsigned char **, size_t *);
+void rx_begin(fido_dev_t *, uint8_t);
+void rx_status(fido_dev_t *, uint8_t, int);
 int tx(fido_dev_t *, uint8_t, const void *, size_t);
+int tx_cancel(fido_dev_t *);
+void io_buf_free(fido_dev_t *);
+void io_buf_reserve(fido_dev_t *, uint64_t);
+
+/* asynchronous operations */
+int async_begin(fido_dev_t *, fido_async_cb_t *, void *);
+void async_end(fido_dev_t *);
+
+/* credential lists */
+bool fido_dev_cred_list_fits(fido_dev_t *, uint64_t,
+    const fido_blob_array_t *, int *);
+int fido_cred_list_req_len(uint8_t, cbor_item_t *[], size_t, bool,
+    uint64_t *);
+size_t fido_cred_list_batch(const fido_cbor_info_t *, uint64_t,
+    const fido_blob_array_t *, size_t, size_t *, fido_blob_t *, size_t *);
+int fido_dev_cred_list_filter(fido_dev_t *, const fido_blob_array_t *,
+    fido_blob_array_t *, int *);
+int fido_dev_cred_list_probe(fido_dev_t *, char *, const char *,
+    const fido_blob_array_t *, size_t *, int *);
+
+/* credential hints */
+int fido_dev_hint_sort(const fido_dev_t *, const char *,
+    const fido_blob_array_t *, fido_blob_array_t *);
+size_t fido_dev_hint_find(const fido_dev_t *, const char *,
+    const fido_blob_array_t *);
+void fido_dev_hint_put(fido_dev_t *, const char *, const fido_blob_t *);
+void fido_dev_hint_reset(fido_dev_t *);
+
+/* time */
+int fido_time_delta(const struct timespec *, int *);
+int fido_time_elapsed(const struct timespec *, int *);
+int fido_time_now(struct timespec *);
 
 /* log */
 #ifdef FIDO_NO_DIAGNOSTIC
@@ -94,18 +166,50 @@ void log_xxd(const void *, size_t);
 #endif /* FIDO_NO_DIAGNOSTIC */
 
 /* u2f */
-int u2f_register(fido_dev_t *, fido_cred_t *, int);
-int u2f_authenticate(fido_dev_t *, fido_assert_t *, int);
+int u2f_register(fido_dev_t *, fido_cred_t *, int *);
+int u2f_authenticate(fido_dev_t *, fido_assert_t *, int *);
 
 /* unexposed fido ops */
 int fido_dev_authkey(fido_dev_t *, es256_pk_t *);
+int fido_dev_authkey_rx(fido_dev_t *, es256_pk_t *, int *);
+int fido_dev_authkey_tx(fido_dev_t *);
 int fido_dev_get_pin_token(fido_dev_t *, const char *, const fido_blob_t *,
-    const es256_pk_t *, fido_blob_t *);
-int fido_do_ecdh(fido_dev_t *, es256_pk_t **, fido_blob_t **);
+    const es256_pk_t *, fido_blob_t *, int *);
+int fido_dev_pin_token_load(fido_dev_t *, const char *, const es256_pk_t *,
+    const fido_blob_t *, fido_blob_t *, int *);
+int fido_do_ecdh(fido_dev_t *, es256_pk_t **, fido_blob_t **, int *);
+int fido_dev_reinit(fido_dev_t *, int *);
+
+/* cancellation */
+bool fido_dev_cancelled(fido_dev_t *);
+int fido_dev_op_end(fido_dev_t *, int);
+void fido_dev_op_begin(fido_dev_t *);
+
+/* cached getinfo */
+int fido_cbor_info_decode(fido_cbor_info_t *, const unsigned char *, size_t);
+int fido_dev_cbor_info_load(fido_dev_t *, int *);
+int info_cache_load(fido_dev_t *, fido_cbor_info_t *);
+void fido_dev_cbor_info_reset(fido_dev_t *);
+void info_cache_remove(fido_dev_t *);
+void info_cache_store(fido_dev_t *, const unsigned char *, size_t);
+
+/* pin session */
+fido_pin_mem_t *fido_dev_pin_mem(fido_dev_t *);
+bool fido_dev_pin_token_cached(const fido_dev_t *, const char *);
+bool fido_dev_ecdh_cached(const fido_dev_t *);
+void fido_dev_ecdh_reset(fido_dev_t *);
+bool fido_dev_pin_session_cached(const fido_dev_t *);
+void fido_dev_pin_session_check(fido_dev_t *, int);
+void fido_dev_pin_session_reset(fido_dev_t *);
+bool fido_dev_pin_session_stale(int);
 
 /* misc */
+void fido_assert_borrow_tx(fido_assert_t *, const fido_assert_t *);
+void fido_assert_move_rx(fido_assert_t *, fido_assert_t *);
 void fido_assert_reset_rx(fido_assert_t *);
 void fido_assert_reset_tx(fido_assert_t *);
+void fido_cred_borrow_tx(fido_cred_t *, const fido_cred_t *);
+void fido_cred_move_rx(fido_cred_t *, fido_cred_t *);
 void fido_cred_reset_rx(fido_cred_t *);
 void fido_cred_reset_tx(fido_cred_t *);
 int check_rp_id(const char *, const unsigned char *);
@@ -19,6 +19,11 @@ typedef void  fido_dev_io_close_t(void *);
 typedef int   fido_dev_io_read_t(void *, unsigned char *, size_t, int);
 typedef int   fido_dev_io_write_t(void *, const unsigned char *, size_t);
 
+struct fido_dev_info;
+
+typedef void  fido_dev_status_cb_t(void *, uint8_t, int);
+typedef void  fido_dev_registry_cb_t(void *, int, const struct fido_dev_info *);
+
 typedef struct fido_dev_io {
 	fido_dev_io_open_t  *open;
 	fido_dev_io_close_t *close;
@@ -35,6 +40,7 @@ typedef enum {
 #ifdef _FIDO_INTERNAL
 #include <cbor.h>
 #include <limits.h>
+#include <time.h>
 
 #include "blob.h"
 #include "../openbsd-compat/openbsd-compat.h"
@@ -52,6 +58,8 @@ typedef struct fido_cbor_info fido_cbor_info_t;
 typedef struct fido_cred fido_cred_t;
 typedef struct fido_dev fido_dev_t;
 typedef struct fido_dev_info fido_dev_info_t;
+typedef struct fido_dev_registry fido_dev_registry_t;
+typedef struct fido_dev_set fido_dev_set_t;
 typedef struct es256_pk es256_pk_t;
 typedef struct es256_sk es256_sk_t;
 typedef struct rs256_pk rs256_pk_t;
@@ -62,6 +70,8 @@ fido_assert_t *fido_assert_new(void);
 fido_cred_t *fido_cred_new(void);
 fido_dev_t *fido_dev_new(void);
 fido_dev_info_t *fido_dev_info_new(size_t);
+fido_dev_registry_t *fido_dev_registry_new(void);
+fido_dev_set_t *fido_dev_set_new(void);
 fido_cbor_info_t *fido_cbor_info_new(void);
 
 void fido_assert_free(fido_assert_t **);
@@ -71,6 +81,8 @@ void fido_dev_force_fido2(fido_dev_t *);
 void fido_dev_force_u2f(fido_dev_t *);
 void fido_dev_free(fido_dev_t **);
 void fido_dev_info_free(fido_dev_info_t **, size_t);
+void fido_dev_registry_free(fido_dev_registry_t **);
+void fido_dev_set_free(fido_dev_set_t **);
 
 /* fido_init() flags. */
 #define FIDO_DEBUG	0x01
@@ -80,6 +92,8 @@ void fido_init(int);
 const unsigned char *fido_assert_authdata_ptr(const fido_assert_t *, size_t);
 const unsigned char *fido_assert_clientdata_hash_ptr(const fido_assert_t *);
 const unsigned char *fido_assert_hmac_secret_ptr(const fido_assert_t *, size_t);
+const unsigned char *fido_assert_hmac_secret2_ptr(const fido_assert_t *,
+    size_t);
 const unsigned char *fido_assert_id_ptr(const fido_assert_t *, size_t);
 const unsigned char *fido_assert_sig_ptr(const fido_assert_t *, size_t);
 const unsigned char *fido_assert_user_id_ptr(const fido_assert_t *, size_t);
@@ -99,6 +113,9 @@ const char *fido_dev_info_manufacturer_string(const fido_dev_info_t *);
 const char *fido_dev_info_path(const fido_dev_info_t *);
 const char *fido_dev_info_product_string(const fido_dev_info_t *);
 const fido_dev_info_t *fido_dev_info_ptr(const fido_dev_info_t *, size_t);
+const fido_dev_info_t *fido_dev_registry_ptr(const fido_dev_registry_t *,
+    size_t);
+fido_dev_t *fido_dev_set_ptr(const fido_dev_set_t *, size_t);
 const uint8_t *fido_cbor_info_protocols_ptr(const fido_cbor_info_t *);
 const unsigned char *fido_cbor_info_aaguid_ptr(const fido_cbor_info_t *);
 const unsigned char *fido_cred_authdata_ptr(const fido_cred_t *);
@@ -116,12 +133,14 @@ int fido_assert_set_clientdata_hash(fido_assert_t *, const unsigned char *,
 int fido_assert_set_count(fido_assert_t *, size_t);
 int fido_assert_set_extensions(fido_assert_t *, int);
 int fido_assert_set_hmac_salt(fido_assert_t *, const unsigned char *, size_t);
+int fido_assert_set_hmac_salt2(fido_assert_t *, const unsigned char *, size_t);
 int fido_assert_set_options(fido_assert_t *, bool, bool) __attribute__((__deprecated__));
 int fido_assert_set_rp(fido_assert_t *, const char *);
 int fido_assert_set_up(fido_assert_t *, fido_opt_t);
 int fido_assert_set_uv(fido_assert_t *, fido_opt_t);
 int fido_assert_set_sig(fido_assert_t *, size_t, const unsigned char *, size_t);
 int fido_assert_verify(const fido_assert_t *, size_t, int, const void *);
+int fido_cbor_set_limits(size_t, size_t, size_t);
 int fido_cred_exclude(fido_cred_t *, const unsigned char *, size_t);
 int fido_cred_set_authdata(fido_cred_t *, const unsigned char *, size_t);
 int fido_cred_set_clientdata_hash(fido_cred_t *, const unsigned char *, size_t);
@@ -137,21 +156,44 @@ int fido_cred_set_user(fido_cred_t *, const unsigned char *, size_t,
     const char *, const char *, const char *);
 int fido_cred_set_x509(fido_cred_t *, const unsigned char *, size_t);
 int fido_cred_verify(const fido_cred_t *);
+int fido_dev_cancel(fido_dev_t *);
 int fido_dev_close(fido_dev_t *);
+int fido_dev_fd(const fido_dev_t *);
 int fido_dev_get_assert(fido_dev_t *, fido_assert_t *, const char *);
+int fido_dev_get_assert_start(fido_dev_t *, fido_assert_t *, const char *);
 int fido_dev_get_cbor_info(fido_dev_t *, fido_cbor_info_t *);
+int fido_dev_get_cbor_info_start(fido_dev_t *, fido_cbor_info_t *);
 int fido_dev_get_retry_count(fido_dev_t *, int *);
 int fido_dev_info_manifest(fido_dev_info_t *, size_t, size_t *);
 int fido_dev_make_cred(fido_dev_t *, fido_cred_t *, const char *);
+int fido_dev_make_cred_start(fido_dev_t *, fido_cred_t *, const char *);
 int fido_dev_open(fido_dev_t *, const char *);
+int fido_dev_registry_fd(const fido_dev_registry_t *);
+int fido_dev_registry_open(fido_dev_registry_t *, fido_dev_registry_cb_t *,
+    void *);
+int fido_dev_registry_update(fido_dev_registry_t *, int);
 int fido_dev_reset(fido_dev_t *);
+int fido_dev_set_cbor_info_cache(fido_dev_t *, const char *);
 int fido_dev_set_io_functions(fido_dev_t *, const fido_dev_io_t *);
+int fido_dev_set_cred_hints(fido_dev_t *, size_t);
+int fido_dev_set_get_assert(fido_dev_set_t *, fido_assert_t *, const char *,
+    size_t *);
+int fido_dev_set_make_cred(fido_dev_set_t *, fido_cred_t *, const char *,
+    size_t *);
+int fido_dev_set_open(fido_dev_set_t *, const fido_dev_info_t *, size_t);
 int fido_dev_set_pin(fido_dev_t *, const char *, const char *);
+int fido_dev_set_pin_session(fido_dev_t *, bool);
+int fido_dev_set_resume(fido_dev_t *, bool);
+int fido_dev_set_status_cb(fido_dev_t *, fido_dev_status_cb_t *, void *);
+int fido_dev_set_timeout(fido_dev_t *, int);
+int fido_dev_set_u2f_poll(fido_dev_t *, int, int);
+int fido_dev_step(fido_dev_t *);
 
 size_t fido_assert_authdata_len(const fido_assert_t *, size_t);
 size_t fido_assert_clientdata_hash_len(const fido_assert_t *);
 size_t fido_assert_count(const fido_assert_t *);
 size_t fido_assert_hmac_secret_len(const fido_assert_t *, size_t);
+size_t fido_assert_hmac_secret2_len(const fido_assert_t *, size_t);
 size_t fido_assert_id_len(const fido_assert_t *, size_t);
 size_t fido_assert_sig_len(const fido_assert_t *, size_t);
 size_t fido_assert_user_id_len(const fido_assert_t *, size_t);
@@ -166,6 +208,8 @@ size_t fido_cred_id_len(const fido_cred_t *);
 size_t fido_cred_pubkey_len(const fido_cred_t *);
 size_t fido_cred_sig_len(const fido_cred_t *);
 size_t fido_cred_x5c_len(const fido_cred_t *);
+size_t fido_dev_registry_len(const fido_dev_registry_t *);
+size_t fido_dev_set_len(const fido_dev_set_t *);
 
 uint8_t  fido_assert_flags(const fido_assert_t *, size_t);
 uint8_t  fido_cred_flags(const fido_cred_t *);
@@ -176,7 +220,12 @@ uint8_t  fido_dev_build(const fido_dev_t *);
 uint8_t  fido_dev_flags(const fido_dev_t *);
 int16_t  fido_dev_info_vendor(const fido_dev_info_t *);
 int16_t  fido_dev_info_product(const fido_dev_info_t *);
+uint64_t fido_cbor_info_maxcredcntlst(const fido_cbor_info_t *);
+uint64_t fido_cbor_info_maxcredidlen(const fido_cbor_info_t *);
 uint64_t fido_cbor_info_maxmsgsiz(const fido_cbor_info_t *);
+uint64_t fido_dev_maxmsgsiz(fido_dev_t *);
+
+fido_opt_t fido_dev_option(fido_dev_t *, int);
 
 bool fido_dev_is_fido2(const fido_dev_t *);
 
@@ -63,6 +63,9 @@
 #define FIDO_ERR_INVALID_ARGUMENT	-7
 #define FIDO_ERR_USER_PRESENCE_REQUIRED	-8
 #define FIDO_ERR_INTERNAL		-9
+#define FIDO_ERR_CBOR_LIMIT		-10
+#define FIDO_ERR_RX_INVALID_UTF8	-11
+#define FIDO_ERR_IN_PROGRESS		-12
 
 const char *fido_strerr(int);
 
@@ -20,9 +20,18 @@
 #define CTAP_CMD_INIT			0x06
 #define CTAP_CMD_WINK			0x08
 #define CTAP_CMD_CBOR			0x10
+#define CTAP_CMD_CANCEL			0x11
+#define CTAP_CMD_ERROR			0x3f
 #define CTAP_KEEPALIVE			0x3b
 #define CTAP_FRAME_INIT			0x80
 
+/* CTAPHID error codes. */
+#define CTAP_ERR_INVALID_CHANNEL	0x0b
+
+/* CTAPHID keepalive status codes. */
+#define CTAP_KEEPALIVE_PROCESSING	0x01
+#define CTAP_KEEPALIVE_UPNEEDED		0x02
+
 /* CTAPHID CBOR command opcodes. */
 #define CTAP_CBOR_MAKECRED		0x01
 #define CTAP_CBOR_ASSERT		0x02
@@ -47,8 +56,9 @@
 /* HID Broadcast channel ID. */
 #define CTAP_CID_BROADCAST		0xffffffff
 
-/* Expected size of a HID report in bytes. */
+/* Default and maximum size of a HID report in bytes. */
 #define CTAP_RPT_SIZE			64
+#define CTAP_MAX_RPT_SIZE		1024
 
 /* Randomness device on UNIX-like platforms. */
 #ifndef FIDO_RANDOM_DEV
@@ -74,6 +84,17 @@
 #define COSE_P256	1
 #define COSE_ED25519	6
 
+/* Authenticator options; see fido_dev_option(). */
+#define FIDO_OPTION_PLAT	0x01
+#define FIDO_OPTION_RK		0x02
+#define FIDO_OPTION_CLIENT_PIN	0x04
+#define FIDO_OPTION_UP		0x08
+#define FIDO_OPTION_UV		0x10
+
+/* Device registry events. */
+#define FIDO_DEV_ADDED		0x01
+#define FIDO_DEV_REMOVED	0x02
+
 /* Supported extensions. */
 #define FIDO_EXT_HMAC_SECRET	0x01
 
@@ -7,17 +7,17 @@
 #include <sys/types.h>
 
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <linux/hidraw.h>
 
 #include <fcntl.h>
 #include <libudev.h>
+#include <poll.h>
 #include <string.h>
 #include <unistd.h>
 
 #include "fido.h"
 
-#define REPORT_LEN	65
-
 static int
 get_key_len(uint8_t tag, uint8_t *key, size_t *key_len)
 {
@@ -95,42 +95,140 @@ get_usage_info(const struct hidraw_report_descriptor *hrd, uint32_t *usage_page,
 	return (0);
 }
 
+/*
+ * Compute the length in bytes of the input and output reports from the
+ * Report Size and Report Count global items in effect at the Input and
+ * Output main items.
+ */
 static int
-get_report_descriptor(const char *path, struct hidraw_report_descriptor *hrd)
+get_report_len(const struct hidraw_report_descriptor *hrd, size_t *in_len,
+    size_t *out_len)
 {
-	int	r;
-	int	s = -1;
-	int	fd;
-	int	ok = -1;
+	const uint8_t	*ptr;
+	size_t		 len;
+	uint32_t	 report_size = 0;
+	uint32_t	 report_count = 0;
 
-	if ((fd = open(path, O_RDONLY)) < 0) {
-		log_debug("%s: open", __func__);
-		return (-1);
+	ptr = hrd->value;
+	len = hrd->size;
+
+	*in_len = 0;
+	*out_len = 0;
+
+	while (len > 0) {
+		const uint8_t tag = ptr[0];
+		ptr++;
+		len--;
+
+		uint8_t  key;
+		size_t   key_len;
+		uint32_t key_val;
+
+		if (get_key_len(tag, &key, &key_len) < 0 || key_len > len ||
+		    get_key_val(ptr, key_len, &key_val) < 0) {
+			return (-1);
+		}
+
+		if (key == 0x74) {
+			report_size = key_val;
+		} else if (key == 0x94) {
+			report_count = key_val;
+		} else if (key == 0x80) {
+			*in_len = (size_t)report_size * report_count / 8;
+		} else if (key == 0x90) {
+			*out_len = (size_t)report_size * report_count / 8;
+		}
+
+		ptr += key_len;
+		len -= key_len;
 	}
 
+	return (0);
+}
+
+static int
+get_report_descriptor_fd(int fd, struct hidraw_report_descriptor *hrd)
+{
+	int	r;
+	int	s = -1;
+
 	if ((r = ioctl(fd, HIDIOCGRDESCSIZE, &s)) < 0 || s < 0 ||
 	    (unsigned)s > HID_MAX_DESCRIPTOR_SIZE) {
 		log_debug("%s: ioctl HIDIOCGRDESCSIZE", __func__);
-		goto fail;
+		return (-1);
 	}
 
 	hrd->size = s;
 
 	if ((r = ioctl(fd, HIDIOCGRDESC, hrd)) < 0) {
 		log_debug("%s: ioctl HIDIOCGRDESC", __func__);
-		goto fail;
+		return (-1);
 	}
 
-	ok = 0;
-fail:
-	if (fd != -1)
-		close(fd);
+	return (0);
+}
+
+static int
+get_report_descriptor(const char *path, struct hidraw_report_descriptor *hrd)
+{
+	int	fd;
+	int	ok;
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		log_debug("%s: open", __func__);
+		return (-1);
+	}
+
+	ok = get_report_descriptor_fd(fd, hrd);
+	close(fd);
 
 	return (ok);
 }
 
+/*
+ * Read the report descriptor exported by the kernel in sysfs. Unlike the
+ * hidraw ioctls, this does not require access to the device node, nor does
+ * it wake an autosuspended device.
+ */
+static int
+get_report_descriptor_sysfs(struct udev_device *hid_parent,
+    struct hidraw_report_descriptor *hrd)
+{
+	const char	*syspath;
+	char		 path[PATH_MAX];
+	ssize_t		 n;
+	int		 r;
+	int		 fd;
+
+	if ((syspath = udev_device_get_syspath(hid_parent)) == NULL)
+		return (-1);
+
+	if ((r = snprintf(path, sizeof(path), "%s/report_descriptor",
+	    syspath)) < 0 || (size_t)r >= sizeof(path)) {
+		log_debug("%s: snprintf", __func__);
+		return (-1);
+	}
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		log_debug("%s: open %s", __func__, path);
+		return (-1);
+	}
+
+	n = read(fd, hrd->value, sizeof(hrd->value));
+	close(fd);
+
+	if (n <= 0) {
+		log_debug("%s: read %s", __func__, path);
+		return (-1);
+	}
+
+	hrd->size = (uint32_t)n;
+
+	return (0);
+}
+
 static bool
-is_fido(const char *path)
+is_fido(struct udev_device *hid_parent, const char *path)
 {
 	uint32_t			usage = 0;
 	uint32_t			usage_page = 0;
@@ -138,10 +236,12 @@ is_fido(const char *path)
 
 	memset(&hrd, 0, sizeof(hrd));
 
-	if (get_report_descriptor(path, &hrd) < 0 ||
-	    get_usage_info(&hrd, &usage_page, &usage) < 0) {
+	if (get_report_descriptor_sysfs(hid_parent, &hrd) < 0 &&
+	    get_report_descriptor(path, &hrd) < 0)
+		return (false);
+
+	if (get_usage_info(&hrd, &usage_page, &usage) < 0)
 		return (false);
-	}
 
 	return (usage_page == 0xf1d0);
 }
@@ -179,29 +279,50 @@ parse_uevent(struct udev_device *dev, int16_t *vendor_id, int16_t *product_id)
 	return (ok);
 }
 
+/* The HID_UNIQ value of a hid device; usually its USB serial number. */
+static char *
+parse_uevent_uniq(struct udev_device *dev)
+{
+	const char	*uevent;
+	char		*cp;
+	char		*p;
+	char		*s;
+	char		*uniq = NULL;
+
+	if ((uevent = udev_device_get_sysattr_value(dev, "uevent")) == NULL)
+		return (NULL);
+
+	if ((s = cp = strdup(uevent)) == NULL)
+		return (NULL);
+
+	for ((p = strsep(&cp, "\n")); p && *p != '\0'; (p = strsep(&cp, "\n"))) {
+		if (strncmp(p, "HID_UNIQ=", 9) == 0) {
+			if (p[9] != '\0')
+				uniq = strdup(p + 9);
+			break;
+		}
+	}
+
+	free(s);
+
+	return (uniq);
+}
+
 static int
-copy_info(fido_dev_info_t *di, struct udev *udev,
-    struct udev_list_entry *udev_entry)
+copy_info_dev(fido_dev_info_t *di, struct udev_device *dev)
 {
-	const char		*name;
 	const char		*path;
 	const char		*manufacturer;
 	const char		*product;
-	struct udev_device	*dev = NULL;
 	struct udev_device	*hid_parent;
 	struct udev_device	*usb_parent;
 	int			 ok = -1;
 
 	memset(di, 0, sizeof(*di));
 
-	if ((name = udev_list_entry_get_name(udev_entry)) == NULL ||
-	    (dev = udev_device_new_from_syspath(udev, name)) == NULL ||
-	    (path = udev_device_get_devnode(dev)) == NULL ||
-	    is_fido(path) == 0)
-		goto fail;
-
-	if ((hid_parent = udev_device_get_parent_with_subsystem_devtype(dev,
-	    "hid", NULL)) == NULL)
+	if ((path = udev_device_get_devnode(dev)) == NULL ||
+	    (hid_parent = udev_device_get_parent_with_subsystem_devtype(dev,
+	    "hid", NULL)) == NULL || is_fido(hid_parent, path) == 0)
 		goto fail;
 
 	if ((usb_parent = udev_device_get_parent_with_subsystem_devtype(dev,
@@ -226,9 +347,6 @@ copy_info(fido_dev_info_t *di, struct udev *udev,
 
 	ok = 0;
 fail:
-	if (dev != NULL)
-		udev_device_unref(dev);
-
 	if (ok < 0) {
 		free(di->path);
 		free(di->manufacturer);
@@ -239,6 +357,26 @@ fail:
 	return (ok);
 }
 
+static int
+copy_info(fido_dev_info_t *di, struct udev *udev,
+    struct udev_list_entry *udev_entry)
+{
+	const char		*name;
+	struct udev_device	*dev;
+	int			 ok;
+
+	memset(di, 0, sizeof(*di));
+
+	if ((name = udev_list_entry_get_name(udev_entry)) == NULL ||
+	    (dev = udev_device_new_from_syspath(udev, name)) == NULL)
+		return (-1);
+
+	ok = copy_info_dev(di, dev);
+	udev_device_unref(dev);
+
+	return (ok);
+}
+
 int
 fido_dev_info_manifest(fido_dev_info_t *devlist, size_t ilen, size_t *olen)
 {
@@ -282,63 +420,280 @@ fail:
 	return (r);
 }
 
+struct hid_monitor {
+	struct udev		*udev;
+	struct udev_monitor	*mon;
+};
+
+void *
+hid_monitor_open(void)
+{
+	struct hid_monitor *hm;
+
+	if ((hm = calloc(1, sizeof(*hm))) == NULL)
+		return (NULL);
+
+	if ((hm->udev = udev_new()) == NULL ||
+	    (hm->mon = udev_monitor_new_from_netlink(hm->udev,
+	    "udev")) == NULL) {
+		log_debug("%s: udev_monitor_new_from_netlink", __func__);
+		goto fail;
+	}
+
+	if (udev_monitor_filter_add_match_subsystem_devtype(hm->mon, "hidraw",
+	    NULL) < 0 || udev_monitor_enable_receiving(hm->mon) < 0) {
+		log_debug("%s: udev_monitor_enable_receiving", __func__);
+		goto fail;
+	}
+
+	return (hm);
+fail:
+	hid_monitor_close(hm);
+
+	return (NULL);
+}
+
+void
+hid_monitor_close(void *handle)
+{
+	struct hid_monitor *hm = handle;
+
+	if (hm->mon != NULL)
+		udev_monitor_unref(hm->mon);
+	if (hm->udev != NULL)
+		udev_unref(hm->udev);
+
+	free(hm);
+}
+
+int
+hid_monitor_fd(void *handle)
+{
+	struct hid_monitor *hm = handle;
+
+	return (udev_monitor_get_fd(hm->mon));
+}
+
+/*
+ * Fetch the next hotplug event without blocking. On removal, only di->path
+ * is filled in. Returns 1 if an event was fetched, 0 if there are none
+ * pending, and -1 on error.
+ */
+int
+hid_monitor_next(void *handle, int *event, fido_dev_info_t *di)
+{
+	struct hid_monitor	*hm = handle;
+	struct udev_device	*dev;
+	const char		*action;
+	const char		*path;
+	int			 r = 0;
+
+	memset(di, 0, sizeof(*di));
+
+	while (r == 0 && (dev = udev_monitor_receive_device(hm->mon)) != NULL) {
+		if ((action = udev_device_get_action(dev)) == NULL ||
+		    (path = udev_device_get_devnode(dev)) == NULL) {
+			udev_device_unref(dev);
+			continue;
+		}
+
+		if (strcmp(action, "add") == 0) {
+			if (copy_info_dev(di, dev) == 0) {
+				*event = FIDO_DEV_ADDED;
+				r = 1;
+			}
+		} else if (strcmp(action, "remove") == 0) {
+			if ((di->path = strdup(path)) == NULL)
+				r = -1;
+			else {
+				*event = FIDO_DEV_REMOVED;
+				r = 1;
+			}
+		}
+
+		udev_device_unref(dev);
+	}
+
+	return (r);
+}
+
+struct hid_linux {
+	int	fd;
+	size_t	report_in_len;  /* input report length */
+	size_t	report_out_len; /* output report length */
+};
+
+/* Report lengths outside [CTAP_RPT_SIZE, CTAP_MAX_RPT_SIZE] are ignored. */
+static void
+set_report_len(struct hid_linux *ctx)
+{
+	struct hidraw_report_descriptor	hrd;
+	size_t				in_len;
+	size_t				out_len;
+
+	ctx->report_in_len = CTAP_RPT_SIZE;
+	ctx->report_out_len = CTAP_RPT_SIZE;
+
+	memset(&hrd, 0, sizeof(hrd));
+
+	if (get_report_descriptor_fd(ctx->fd, &hrd) < 0 ||
+	    get_report_len(&hrd, &in_len, &out_len) < 0) {
+		log_debug("%s: using default report length", __func__);
+		return;
+	}
+
+	if (in_len >= CTAP_RPT_SIZE && in_len <= CTAP_MAX_RPT_SIZE &&
+	    out_len >= CTAP_RPT_SIZE && out_len <= CTAP_MAX_RPT_SIZE) {
+		ctx->report_in_len = in_len;
+		ctx->report_out_len = out_len;
+	} else
+		log_debug("%s: in_len=%zu, out_len=%zu", __func__, in_len,
+		    out_len);
+}
+
 void *
 hid_open(const char *path)
 {
-	int *fd;
+	struct hid_linux *ctx;
+
+	if ((ctx = calloc(1, sizeof(*ctx))) == NULL)
+		return (NULL);
 
-	if ((fd = malloc(sizeof(*fd))) == NULL ||
-	    (*fd = open(path, O_RDWR)) < 0) {
-		free(fd);
+	if ((ctx->fd = open(path, O_RDWR)) < 0) {
+		free(ctx);
 		return (NULL);
 	}
 
-	return (fd);
+	set_report_len(ctx);
+
+	return (ctx);
 }
 
 void
 hid_close(void *handle)
 {
-	int *fd = handle;
+	struct hid_linux *ctx = handle;
 
-	close(*fd);
-	free(fd);
+	close(ctx->fd);
+	free(ctx);
 }
 
 int
-hid_read(void *handle, unsigned char *buf, size_t len, int ms)
+hid_fd(void *handle)
+{
+	struct hid_linux *ctx = handle;
+
+	return (ctx->fd);
+}
+
+size_t
+hid_report_in_len(void *handle)
+{
+	struct hid_linux *ctx = handle;
+
+	return (ctx->report_in_len);
+}
+
+size_t
+hid_report_out_len(void *handle)
 {
-	int	*fd = handle;
-	ssize_t	 r;
+	struct hid_linux *ctx = handle;
 
-	(void)ms; /* XXX */
+	return (ctx->report_out_len);
+}
 
-	if (len != REPORT_LEN - 1) {
+/* Returns -1 on error, 0 if fd did not become readable within ms, 1 if so. */
+/*
+ * The serial number of the device behind handle, or NULL if it reports
+ * none.
+ */
+char *
+hid_serial(void *handle)
+{
+	struct hid_linux	*ctx = handle;
+	struct stat		 st;
+	struct udev		*udev = NULL;
+	struct udev_device	*dev = NULL;
+	struct udev_device	*hid_parent;
+	char			*serial = NULL;
+
+	if (fstat(ctx->fd, &st) < 0 || !S_ISCHR(st.st_mode)) {
+		log_debug("%s: fstat", __func__);
+		goto fail;
+	}
+
+	if ((udev = udev_new()) == NULL ||
+	    (dev = udev_device_new_from_devnum(udev, 'c', st.st_rdev)) == NULL)
+		goto fail;
+
+	if ((hid_parent = udev_device_get_parent_with_subsystem_devtype(dev,
+	    "hid", NULL)) != NULL)
+		serial = parse_uevent_uniq(hid_parent);
+fail:
+	if (dev != NULL)
+		udev_device_unref(dev);
+	if (udev != NULL)
+		udev_unref(udev);
+
+	return (serial);
+}
+
+static int
+waitfd(int fd, int ms)
+{
+	struct pollfd	pfd;
+	int		r;
+
+	memset(&pfd, 0, sizeof(pfd));
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	if ((r = poll(&pfd, 1, ms)) < 0) {
+		log_debug("%s: poll", __func__);
+		return (-1);
+	}
+
+	return (r > 0);
+}
+
+int
+hid_read(void *handle, unsigned char *buf, size_t len, int ms)
+{
+	struct hid_linux	*ctx = handle;
+	ssize_t			 r;
+	int			 ok;
+
+	if (len != ctx->report_in_len) {
 		log_debug("%s: invalid len", __func__);
 		return (-1);
 	}
 
-	if ((r = read(*fd, buf, len)) < 0 || r != REPORT_LEN - 1)
+	if (ms != -1 && (ok = waitfd(ctx->fd, ms)) < 1) {
+		log_debug("%s: waitfd=%d", __func__, ok);
+		return (ok); /* 0: nothing to read within ms */
+	}
+
+	if ((r = read(ctx->fd, buf, len)) < 0 || (size_t)r != len)
 		return (-1);
 
-	return (REPORT_LEN - 1);
+	return ((int)len);
 }
 
 int
 hid_write(void *handle, const unsigned char *buf, size_t len)
 {
-	int	*fd = handle;
-	ssize_t	 r;
+	struct hid_linux	*ctx = handle;
+	ssize_t			 r;
 
-	if (len != REPORT_LEN) {
+	if (len != ctx->report_out_len + 1) {
 		log_debug("%s: invalid len", __func__);
 		return (-1);
 	}
 
-	if ((r = write(*fd, buf, len)) < 0 || r != REPORT_LEN) {
+	if ((r = write(ctx->fd, buf, len)) < 0 || (size_t)r != len) {
 		log_debug("%s: write", __func__);
 		return (-1);
 	}
 
-	return (REPORT_LEN);
+	return ((int)len);
 }
@@ -249,6 +249,36 @@ fail:
 	return (r);
 }
 
+void *
+hid_monitor_open(void)
+{
+	return (NULL); /* no hotplug notifications; the registry rescans */
+}
+
+void
+hid_monitor_close(void *handle)
+{
+	(void)handle;
+}
+
+int
+hid_monitor_fd(void *handle)
+{
+	(void)handle;
+
+	return (-1);
+}
+
+int
+hid_monitor_next(void *handle, int *event, fido_dev_info_t *di)
+{
+	(void)handle;
+	(void)event;
+	(void)di;
+
+	return (-1);
+}
+
 void *
 hid_open(const char *path)
 {
@@ -325,6 +355,43 @@ hid_close(void *handle)
 	free(dev);
 }
 
+int
+hid_fd(void *handle)
+{
+	(void)handle;
+
+	return (-1); /* no pollable descriptor */
+}
+
+size_t
+hid_report_in_len(void *handle)
+{
+	(void)handle;
+
+	return (REPORT_LEN - 1);
+}
+
+size_t
+hid_report_out_len(void *handle)
+{
+	(void)handle;
+
+	return (REPORT_LEN - 1);
+}
+
+char *
+hid_serial(void *handle)
+{
+	struct dev	*dev = handle;
+	char		 buf[512];
+
+	if (get_utf8(dev->ref, CFSTR(kIOHIDSerialNumberKey), buf,
+	    sizeof(buf)) < 0 || buf[0] == '\0')
+		return (NULL);
+
+	return (strdup(buf));
+}
+
 static void
 read_callback(void *context, IOReturn result, void *dev, IOHIDReportType type,
     uint32_t report_id, uint8_t *report, CFIndex report_len)
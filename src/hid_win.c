@@ -252,6 +252,36 @@ fail:
 	return (r);
 }
 
+void *
+hid_monitor_open(void)
+{
+	return (NULL); /* no hotplug notifications; the registry rescans */
+}
+
+void
+hid_monitor_close(void *handle)
+{
+	(void)handle;
+}
+
+int
+hid_monitor_fd(void *handle)
+{
+	(void)handle;
+
+	return (-1);
+}
+
+int
+hid_monitor_next(void *handle, int *event, fido_dev_info_t *di)
+{
+	(void)handle;
+	(void)event;
+	(void)di;
+
+	return (-1);
+}
+
 void *
 hid_open(const char *path)
 {
@@ -273,6 +303,63 @@ hid_close(void *handle)
 	CloseHandle(handle);
 }
 
+int
+hid_fd(void *handle)
+{
+	(void)handle;
+
+	return (-1); /* no pollable descriptor */
+}
+
+size_t
+hid_report_in_len(void *handle)
+{
+	(void)handle;
+
+	return (REPORT_LEN - 1);
+}
+
+size_t
+hid_report_out_len(void *handle)
+{
+	(void)handle;
+
+	return (REPORT_LEN - 1);
+}
+
+char *
+hid_serial(void *handle)
+{
+	wchar_t	 buf[512];
+	char	*serial;
+	int	 utf8_len;
+
+	if (HidD_GetSerialNumberString(handle, &buf, sizeof(buf)) == false) {
+		log_debug("%s: HidD_GetSerialNumberString", __func__);
+		return (NULL);
+	}
+
+	if ((utf8_len = WideCharToMultiByte(CP_UTF8, WC_ERR_INVALID_CHARS, buf,
+	    -1, NULL, 0, NULL, NULL)) <= 1 || utf8_len > 128) {
+		log_debug("%s: WideCharToMultiByte", __func__);
+		return (NULL);
+	}
+
+	if ((serial = malloc(utf8_len)) == NULL) {
+		log_debug("%s: malloc", __func__);
+		return (NULL);
+	}
+
+	if (WideCharToMultiByte(CP_UTF8, WC_ERR_INVALID_CHARS, buf, -1,
+	    serial, utf8_len, NULL, NULL) != utf8_len) {
+		log_debug("%s: WideCharToMultiByte", __func__);
+		free(serial);
+		return (NULL);
+	}
+
+	return (serial);
+}
+
 int
 hid_read(void *handle, unsigned char *buf, size_t len, int ms)
 {
@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2019 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+
+#include <string.h>
+
+#include "fido.h"
+
+/*
+ * Per-device record of the credential that last produced an assertion for
+ * a given relying party, most recently used first. When an allow list
+ * holds that credential, it is tried first; the rest of the list follows,
+ * so a stale hint costs nothing but its own position. Hints are kept for
+ * the device's path and dropped once the device is opened elsewhere.
+ */
+
+static void
+hint_clear(fido_cred_hint_t *h)
+{
+	if (h->id.ptr != NULL) {
+		explicit_bzero(h->id.ptr, h->id.len);
+		free(h->id.ptr);
+	}
+
+	memset(h, 0, sizeof(*h));
+}
+
+void
+fido_dev_hint_reset(fido_dev_t *dev)
+{
+	for (size_t i = 0; i < dev->hint_len; i++)
+		hint_clear(&dev->hint[i]);
+
+	free(dev->hint);
+	dev->hint = NULL;
+	dev->hint_len = 0;
+}
+
+static fido_cred_hint_t *
+hint_lookup(const fido_dev_t *dev, const unsigned char *rp_id_hash)
+{
+	for (size_t i = 0; i < dev->hint_len; i++)
+		if (memcmp(dev->hint[i].rp_id_hash, rp_id_hash,
+		    sizeof(dev->hint[i].rp_id_hash)) == 0)
+			return (&dev->hint[i]);
+
+	return (NULL);
+}
+
+/*
+ * Return the index in list of the credential that last succeeded with
+ * rp_id on dev, or list->len if there is none.
+ */
+size_t
+fido_dev_hint_find(const fido_dev_t *dev, const char *rp_id,
+    const fido_blob_array_t *list)
+{
+	unsigned char		 rp_id_hash[SHA256_DIGEST_LENGTH];
+	const fido_cred_hint_t	*h;
+
+	if (dev->hint_len == 0 || rp_id == NULL || list->len < 2)
+		return (list->len);
+
+	if (EVP_Digest(rp_id, strlen(rp_id), rp_id_hash, NULL,
+	    fido_evp_sha256(), NULL) == 0 || (h = hint_lookup(dev,
+	    rp_id_hash)) == NULL)
+		return (list->len);
+
+	for (size_t i = 0; i < list->len; i++)
+		if (list->ptr[i].len == h->id.len &&
+		    memcmp(list->ptr[i].ptr, h->id.ptr, h->id.len) == 0) {
+			log_debug("%s: hint %zu/%zu", __func__, i, list->len);
+			return (i);
+		}
+
+	return (list->len);
+}
+
+/*
+ * If dev holds a hint for rp_id, fill out with the entries of list, the
+ * hinted one first; the blobs are shared with list, so only out->ptr is to
+ * be freed. Otherwise, out is left empty.
+ */
+int
+fido_dev_hint_sort(const fido_dev_t *dev, const char *rp_id,
+    const fido_blob_array_t *list, fido_blob_array_t *out)
+{
+	size_t idx;
+
+	memset(out, 0, sizeof(*out));
+
+	if ((idx = fido_dev_hint_find(dev, rp_id, list)) == list->len ||
+	    idx == 0)
+		return (0);
+
+	if ((out->ptr = calloc(list->len, sizeof(*out->ptr))) == NULL)
+		return (-1);
+
+	out->ptr[0] = list->ptr[idx];
+	memcpy(&out->ptr[1], &list->ptr[0], idx * sizeof(*out->ptr));
+	memcpy(&out->ptr[idx + 1], &list->ptr[idx + 1],
+	    (list->len - idx - 1) * sizeof(*out->ptr));
+	out->len = list->len;
+
+	return (0);
+}
+
+/* Record id as the credential that last succeeded with rp_id on dev. */
+void
+fido_dev_hint_put(fido_dev_t *dev, const char *rp_id, const fido_blob_t *id)
+{
+	unsigned char		 rp_id_hash[SHA256_DIGEST_LENGTH];
+	fido_cred_hint_t	 h;
+	fido_cred_hint_t	*p;
+
+	if (dev->hint_max == 0 || rp_id == NULL || id->len == 0)
+		return;
+
+	memset(&h, 0, sizeof(h));
+
+	if (EVP_Digest(rp_id, strlen(rp_id), rp_id_hash, NULL,
+	    fido_evp_sha256(), NULL) == 0)
+		return;
+
+	if (dev->hint == NULL && (dev->hint = calloc(dev->hint_max,
+	    sizeof(*dev->hint))) == NULL)
+		return;
+
+	if ((p = hint_lookup(dev, rp_id_hash)) != NULL) {
+		h = *p; /* take ownership of the old entry */
+		memmove(p, p + 1, (size_t)(&dev->hint[--dev->hint_len] - p) *
+		    sizeof(*p));
+	} else if (dev->hint_len == dev->hint_max)
+		hint_clear(&dev->hint[--dev->hint_len]); /* evict the lru */
+
+	memcpy(h.rp_id_hash, rp_id_hash, sizeof(h.rp_id_hash));
+
+	if (fido_blob_set(&h.id, id->ptr, id->len) < 0) {
+		hint_clear(&h);
+		return;
+	}
+
+	memmove(&dev->hint[1], &dev->hint[0], dev->hint_len *
+	    sizeof(*dev->hint));
+	dev->hint[0] = h;
+	dev->hint_len++;
+}
@@ -12,11 +12,12 @@ decode_version(const cbor_item_t *item, void *arg)
 {
 	fido_str_array_t	*v = arg;
 	const size_t		 i = v->len;
+	int			 r;
 
 	/* keep ptr[x] and len consistent */
-	if (cbor_string_copy(item, &v->ptr[i]) < 0) {
+	if ((r = cbor_string_copy(item, &v->ptr[i])) < 0) {
 		log_debug("%s: cbor_string_copy", __func__);
-		return (-1);
+		return (r);
 	}
 
 	v->len++;
@@ -27,6 +28,8 @@ decode_version(const cbor_item_t *item, void *arg)
 static int
 decode_versions(const cbor_item_t *item, fido_str_array_t *v)
 {
+	int r;
+
 	v->ptr = NULL;
 	v->len = 0;
 
@@ -40,9 +43,9 @@ decode_versions(const cbor_item_t *item, fido_str_array_t *v)
 	if (v->ptr == NULL)
 		return (-1);
 
-	if (cbor_array_iter(item, v, decode_version) < 0) {
+	if ((r = cbor_array_iter(item, v, decode_version)) < 0) {
 		log_debug("%s: decode_version", __func__);
-		return (-1);
+		return (r);
 	}
 
 	return (0);
@@ -53,11 +56,12 @@ decode_extension(const cbor_item_t *item, void *arg)
 {
 	fido_str_array_t	*e = arg;
 	const size_t		 i = e->len;
+	int			 r;
 
 	/* keep ptr[x] and len consistent */
-	if (cbor_string_copy(item, &e->ptr[i]) < 0) {
+	if ((r = cbor_string_copy(item, &e->ptr[i])) < 0) {
 		log_debug("%s: cbor_string_copy", __func__);
-		return (-1);
+		return (r);
 	}
 
 	e->len++;
@@ -68,6 +72,8 @@ decode_extension(const cbor_item_t *item, void *arg)
 static int
 decode_extensions(const cbor_item_t *item, fido_str_array_t *e)
 {
+	int r;
+
 	e->ptr = NULL;
 	e->len = 0;
 
@@ -81,9 +87,9 @@ decode_extensions(const cbor_item_t *item, fido_str_array_t *e)
 	if (e->ptr == NULL)
 		return (-1);
 
-	if (cbor_array_iter(item, e, decode_extension) < 0) {
+	if ((r = cbor_array_iter(item, e, decode_extension)) < 0) {
 		log_debug("%s: decode_extension", __func__);
-		return (-1);
+		return (r);
 	}
 
 	return (0);
@@ -109,6 +115,7 @@ decode_option(const cbor_item_t *key, const cbor_item_t *val, void *arg)
 {
 	fido_opt_array_t	*o = arg;
 	const size_t		 i = o->len;
+	int			 r;
 
 	if (cbor_isa_float_ctrl(val) == false ||
 	    cbor_float_get_width(val) != CBOR_FLOAT_0 ||
@@ -117,9 +124,9 @@ decode_option(const cbor_item_t *key, const cbor_item_t *val, void *arg)
 		return (-1);
 	}
 
-	if (cbor_string_copy(key, &o->name[i]) < 0) {
+	if ((r = cbor_string_copy(key, &o->name[i])) < 0) {
 		log_debug("%s: cbor_string_copy", __func__);
-		return (-1);
+		return (r);
 	}
 
 	/* keep name/value and len consistent */
@@ -246,6 +253,10 @@ parse_reply_element(const cbor_item_t *key, const cbor_item_t *val, void *arg)
 		return (decode_maxmsgsiz(val, &ci->maxmsgsiz));
 	case 6: /* pinProtocols */
 		return (decode_protocols(val, &ci->protocols));
+	case 7: /* maxCredentialCountInList */
+		return (decode_uint64(val, &ci->maxcredcntlst));
+	case 8: /* maxCredentialIdLength */
+		return (decode_uint64(val, &ci->maxcredidlen));
 	default:
 		log_debug("%s: unknown key %d", __func__,
 		    (int)cbor_get_uint8(key));
@@ -269,29 +280,45 @@ fido_dev_get_cbor_info_tx(fido_dev_t *dev)
 	return (FIDO_OK);
 }
 
+int
+fido_cbor_info_decode(fido_cbor_info_t *ci, const unsigned char *reply,
+    size_t reply_len)
+{
+	memset(ci, 0, sizeof(*ci));
+
+	return (parse_cbor_reply(reply, reply_len, ci, parse_reply_element));
+}
+
 static int
-fido_dev_get_cbor_info_rx(fido_dev_t *dev, fido_cbor_info_t *ci, int ms)
+fido_dev_get_cbor_info_rx(fido_dev_t *dev, fido_cbor_info_t *ci, int *ms)
 {
 	const uint8_t	cmd = CTAP_FRAME_INIT | CTAP_CMD_CBOR;
 	unsigned char	reply[512];
 	int		reply_len;
+	int		r;
 
 	log_debug("%s: dev=%p, ci=%p, ms=%d", __func__, (void *)dev,
-	    (void *)ci, ms);
+	    (void *)ci, *ms);
 
 	memset(ci, 0, sizeof(*ci));
 
 	if ((reply_len = rx(dev, cmd, &reply, sizeof(reply), ms)) < 0) {
 		log_debug("%s: rx", __func__);
-		return (FIDO_ERR_RX);
+		return (rx_error(ms));
 	}
 
-	return (parse_cbor_reply(reply, (size_t)reply_len, ci,
-	    parse_reply_element));
+	if ((r = fido_cbor_info_decode(ci, reply,
+	    (size_t)reply_len)) != FIDO_OK)
+		return (r);
+
+	if (dev->info_cache_dir != NULL)
+		info_cache_store(dev, reply, (size_t)reply_len);
+
+	return (FIDO_OK);
 }
 
 static int
-fido_dev_get_cbor_info_wait(fido_dev_t *dev, fido_cbor_info_t *ci, int ms)
+fido_dev_get_cbor_info_wait(fido_dev_t *dev, fido_cbor_info_t *ci, int *ms)
 {
 	int r;
 
@@ -302,10 +329,287 @@ fido_dev_get_cbor_info_wait(fido_dev_t *dev, fido_cbor_info_t *ci, int ms)
 	return (FIDO_OK);
 }
 
+static const struct {
+	const char	*name;
+	int		 bit;
+} info_opt[] = {
+	{ "plat",	FIDO_OPTION_PLAT },
+	{ "rk",		FIDO_OPTION_RK },
+	{ "clientPin",	FIDO_OPTION_CLIENT_PIN },
+	{ "up",		FIDO_OPTION_UP },
+	{ "uv",		FIDO_OPTION_UV },
+};
+
+/*
+ * Record which of the options we know about are present in the device's
+ * cached getinfo, and which of those are true, so that they can be tested
+ * without walking the options array.
+ */
+static void
+index_options(fido_dev_t *dev)
+{
+	const fido_opt_array_t	*o = &dev->info->options;
+	const size_t		 n = sizeof(info_opt) / sizeof(*info_opt);
+
+	dev->info_opt = 0;
+	dev->info_opt_true = 0;
+
+	for (size_t i = 0; i < o->len; i++)
+		for (size_t j = 0; j < n; j++)
+			if (strcmp(o->name[i], info_opt[j].name) == 0) {
+				dev->info_opt |= info_opt[j].bit;
+				if (o->value[i])
+					dev->info_opt_true |= info_opt[j].bit;
+			}
+}
+
+/* Keep ci as the device's getinfo. */
+static void
+cbor_info_keep(fido_dev_t *dev, fido_cbor_info_t *ci)
+{
+	fido_cbor_info_free(&dev->info);
+	dev->info = ci;
+	index_options(dev);
+	io_buf_reserve(dev, ci->maxmsgsiz);
+}
+
+/*
+ * Whether the device's getinfo is at hand without talking to it: kept
+ * since it was opened, or found in the on-disk cache.
+ */
+static bool
+cbor_info_cached(fido_dev_t *dev)
+{
+	fido_cbor_info_t *ci;
+
+	if (dev->info != NULL)
+		return (true);
+
+	if (dev->info_cache_dir == NULL || (ci = fido_cbor_info_new()) == NULL)
+		return (false);
+
+	if (info_cache_load(dev, ci) < 0) {
+		fido_cbor_info_free(&ci); /* may be partially decoded */
+		return (false);
+	}
+
+	cbor_info_keep(dev, ci);
+
+	return (true);
+}
+
+/*
+ * Fetch authenticatorGetInfo the first time it is needed and keep it for
+ * as long as the device remains open. A fetch is charged to *ms.
+ */
+int
+fido_dev_cbor_info_load(fido_dev_t *dev, int *ms)
+{
+	fido_cbor_info_t	*ci;
+	int			 r;
+
+	if (cbor_info_cached(dev))
+		return (FIDO_OK);
+
+	if ((ci = fido_cbor_info_new()) == NULL)
+		return (FIDO_ERR_INTERNAL);
+
+	if ((r = fido_dev_get_cbor_info_wait(dev, ci, ms)) != FIDO_OK) {
+		log_debug("%s: fido_dev_get_cbor_info_wait", __func__);
+		fido_cbor_info_free(&ci);
+		return (r);
+	}
+
+	cbor_info_keep(dev, ci);
+
+	return (FIDO_OK);
+}
+
+/* Drop the cached getinfo, e.g. after an operation that changes it. */
+void
+fido_dev_cbor_info_reset(fido_dev_t *dev)
+{
+	fido_cbor_info_free(&dev->info);
+	dev->info_opt = 0;
+	dev->info_opt_true = 0;
+}
+
+static int
+copy_str_array(fido_str_array_t *dst, const fido_str_array_t *src)
+{
+	if (src->len == 0)
+		return (0);
+
+	if ((dst->ptr = calloc(src->len, sizeof(char *))) == NULL)
+		return (-1);
+
+	/* keep ptr[x] and len consistent */
+	for (size_t i = 0; i < src->len; i++) {
+		if ((dst->ptr[i] = strdup(src->ptr[i])) == NULL)
+			return (-1);
+		dst->len++;
+	}
+
+	return (0);
+}
+
+static int
+copy_opt_array(fido_opt_array_t *dst, const fido_opt_array_t *src)
+{
+	if (src->len == 0)
+		return (0);
+
+	dst->name = calloc(src->len, sizeof(char *));
+	dst->value = calloc(src->len, sizeof(bool));
+	if (dst->name == NULL || dst->value == NULL)
+		return (-1);
+
+	/* keep name/value and len consistent */
+	for (size_t i = 0; i < src->len; i++) {
+		if ((dst->name[i] = strdup(src->name[i])) == NULL)
+			return (-1);
+		dst->value[i] = src->value[i];
+		dst->len++;
+	}
+
+	return (0);
+}
+
+static int
+copy_byte_array(fido_byte_array_t *dst, const fido_byte_array_t *src)
+{
+	if (src->len == 0)
+		return (0);
+
+	if ((dst->ptr = calloc(src->len, sizeof(uint8_t))) == NULL)
+		return (-1);
+
+	memcpy(dst->ptr, src->ptr, src->len);
+	dst->len = src->len;
+
+	return (0);
+}
+
+static int
+copy_cbor_info(fido_cbor_info_t *dst, const fido_cbor_info_t *src)
+{
+	memset(dst, 0, sizeof(*dst));
+
+	memcpy(dst->aaguid, src->aaguid, sizeof(dst->aaguid));
+	dst->maxmsgsiz = src->maxmsgsiz;
+	dst->maxcredcntlst = src->maxcredcntlst;
+	dst->maxcredidlen = src->maxcredidlen;
+
+	if (copy_str_array(&dst->versions, &src->versions) < 0 ||
+	    copy_str_array(&dst->extensions, &src->extensions) < 0 ||
+	    copy_opt_array(&dst->options, &src->options) < 0 ||
+	    copy_byte_array(&dst->protocols, &src->protocols) < 0) {
+		log_debug("%s: copy", __func__);
+		return (-1);
+	}
+
+	return (0);
+}
+
+/*
+ * Complete fido_dev_get_cbor_info_start(): decode and keep the reply, as
+ * fido_dev_cbor_info_load() does, and hand a copy to the caller. A NULL
+ * reply means the device's getinfo was already at hand.
+ */
+static int
+fido_dev_get_cbor_info_step(fido_dev_t *dev, void *arg,
+    const unsigned char *reply, size_t reply_len)
+{
+	fido_cbor_info_t	*ci = arg;
+	fido_cbor_info_t	*info;
+	int			 r;
+
+	if (reply != NULL) {
+		if ((info = fido_cbor_info_new()) == NULL)
+			return (FIDO_ERR_INTERNAL);
+		if ((r = fido_cbor_info_decode(info, reply,
+		    reply_len)) != FIDO_OK) {
+			fido_cbor_info_free(&info);
+			return (r);
+		}
+		if (dev->info_cache_dir != NULL)
+			info_cache_store(dev, reply, reply_len);
+		cbor_info_keep(dev, info);
+	}
+
+	if (copy_cbor_info(ci, dev->info) < 0)
+		return (FIDO_ERR_INTERNAL);
+
+	return (FIDO_OK);
+}
+
+int
+fido_dev_get_cbor_info_start(fido_dev_t *dev, fido_cbor_info_t *ci)
+{
+	int r;
+
+	if ((r = async_begin(dev, fido_dev_get_cbor_info_step, ci)) != FIDO_OK)
+		return (r);
+
+	if (cbor_info_cached(dev)) {
+		dev->async.ready = true; /* nothing to send */
+		return (FIDO_OK);
+	}
+
+	if ((r = fido_dev_get_cbor_info_tx(dev)) != FIDO_OK) {
+		log_debug("%s: fido_dev_get_cbor_info_tx", __func__);
+		async_end(dev);
+		return (r);
+	}
+
+	return (FIDO_OK);
+}
+
 int
 fido_dev_get_cbor_info(fido_dev_t *dev, fido_cbor_info_t *ci)
 {
-	return (fido_dev_get_cbor_info_wait(dev, ci, -1));
+	int ms = dev->timeout_ms;
+	int r;
+
+	if ((r = fido_dev_cbor_info_load(dev, &ms)) != FIDO_OK)
+		return (r);
+
+	if (copy_cbor_info(ci, dev->info) < 0)
+		return (FIDO_ERR_INTERNAL);
+
+	return (FIDO_OK);
+}
+
+/*
+ * Look up an option in the device's getinfo: FIDO_OPT_OMIT if the device
+ * does not report it, or if getinfo is unavailable.
+ */
+fido_opt_t
+fido_dev_option(fido_dev_t *dev, int option)
+{
+	int ms = dev->timeout_ms;
+
+	if (fido_dev_is_fido2(dev) == false ||
+	    fido_dev_cbor_info_load(dev, &ms) != FIDO_OK ||
+	    (dev->info_opt & option) == 0)
+		return (FIDO_OPT_OMIT);
+
+	if (dev->info_opt_true & option)
+		return (FIDO_OPT_TRUE);
+
+	return (FIDO_OPT_FALSE);
+}
+
+uint64_t
+fido_dev_maxmsgsiz(fido_dev_t *dev)
+{
+	int ms = dev->timeout_ms;
+
+	if (fido_dev_is_fido2(dev) == false ||
+	    fido_dev_cbor_info_load(dev, &ms) != FIDO_OK)
+		return (0);
+
+	return (dev->info->maxmsgsiz);
 }
 
 /*
@@ -427,6 +731,18 @@ fido_cbor_info_maxmsgsiz(const fido_cbor_info_t *ci)
 	return (ci->maxmsgsiz);
 }
 
+uint64_t
+fido_cbor_info_maxcredcntlst(const fido_cbor_info_t *ci)
+{
+	return (ci->maxcredcntlst);
+}
+
+uint64_t
+fido_cbor_info_maxcredidlen(const fido_cbor_info_t *ci)
+{
+	return (ci->maxcredidlen);
+}
+
 const uint8_t *
 fido_cbor_info_protocols_ptr(const fido_cbor_info_t *ci)
 {
@@ -0,0 +1,245 @@
+/*
+ * Copyright (c) 2019 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include "fido.h"
+#include "packed.h"
+
+/*
+ * On-disk cache of authenticatorGetInfo replies, one file per device path
+ * and serial number. Devices that report no serial number are not cached,
+ * as two of the same model would otherwise share an entry. A file holds a
+ * fixed header followed by the CBOR reply as received. The header records
+ * the CTAPHID version bytes returned by CTAPHID_INIT, so that the entry is
+ * ignored once the firmware changes.
+ */
+
+#define INFO_CACHE_MAGIC	"FIC2"
+#define INFO_CACHE_MAXLEN	512 /* as fido_dev_get_cbor_info_rx() */
+
+PACKED_TYPE(info_cache_hdr_t,
+struct info_cache_hdr {
+	char     magic[4];   /* INFO_CACHE_MAGIC */
+	uint8_t  protocol;   /* ctaphid protocol id */
+	uint8_t  major;      /* major version number */
+	uint8_t  minor;      /* minor version number */
+	uint8_t  build;      /* build version number */
+	uint8_t  flags;      /* capabilities flags */
+	uint16_t len;        /* length of the reply that follows */
+})
+
+static char *
+info_cache_path(const fido_dev_t *dev)
+{
+	unsigned char	 dgst[SHA256_DIGEST_LENGTH];
+	EVP_MD_CTX	*ctx;
+	char		*path;
+	size_t		 len;
+	size_t		 n;
+	int		 ok;
+
+	if (dev->info_cache_dir == NULL || dev->path == NULL ||
+	    dev->serial == NULL || *dev->serial == '\0')
+		return (NULL);
+
+	/* the path and the serial, each with its terminating nul */
+	if ((ctx = EVP_MD_CTX_new()) == NULL)
+		return (NULL);
+
+	ok = EVP_DigestInit_ex(ctx, fido_evp_sha256(), NULL) == 1 &&
+	    EVP_DigestUpdate(ctx, dev->path, strlen(dev->path) + 1) == 1 &&
+	    EVP_DigestUpdate(ctx, dev->serial, strlen(dev->serial) + 1) == 1 &&
+	    EVP_DigestFinal_ex(ctx, dgst, NULL) == 1;
+
+	EVP_MD_CTX_free(ctx);
+
+	if (!ok)
+		return (NULL);
+
+	/* directory, separator, 16 bytes of the digest in hex */
+	len = strlen(dev->info_cache_dir) + 1 + 32 + 1;
+	if ((path = calloc(1, len)) == NULL)
+		return (NULL);
+
+	n = (size_t)snprintf(path, len, "%s/", dev->info_cache_dir);
+	for (size_t i = 0; i < 16; i++, n += 2)
+		snprintf(path + n, len - n, "%02x", dgst[i]);
+
+	return (path);
+}
+
+static void
+info_cache_hdr(const fido_dev_t *dev, info_cache_hdr_t *hdr)
+{
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr->magic, INFO_CACHE_MAGIC, sizeof(hdr->magic));
+	hdr->protocol = dev->attr.protocol;
+	hdr->major = dev->attr.major;
+	hdr->minor = dev->attr.minor;
+	hdr->build = dev->attr.build;
+	hdr->flags = dev->attr.flags;
+}
+
+/*
+ * Fill ci from the device's cache entry, if there is one and it matches
+ * the firmware currently behind the device's path.
+ */
+int
+info_cache_load(fido_dev_t *dev, fido_cbor_info_t *ci)
+{
+	info_cache_hdr_t	 hdr;
+	info_cache_hdr_t	 exp;
+	unsigned char		 reply[INFO_CACHE_MAXLEN];
+	char			*path = NULL;
+	FILE			*fp = NULL;
+	int			 ok = -1;
+
+	if ((path = info_cache_path(dev)) == NULL ||
+	    (fp = fopen(path, "rb")) == NULL)
+		goto fail;
+
+	info_cache_hdr(dev, &exp);
+
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	    memcmp(hdr.magic, exp.magic, sizeof(hdr.magic)) != 0 ||
+	    hdr.protocol != exp.protocol || hdr.major != exp.major ||
+	    hdr.minor != exp.minor || hdr.build != exp.build ||
+	    hdr.flags != exp.flags || hdr.len == 0 ||
+	    hdr.len > sizeof(reply) || fread(reply, hdr.len, 1, fp) != 1 ||
+	    fgetc(fp) != EOF) {
+		log_debug("%s: stale or invalid entry %s", __func__, path);
+		goto fail;
+	}
+
+	if (fido_cbor_info_decode(ci, reply, hdr.len) != FIDO_OK) {
+		log_debug("%s: fido_cbor_info_decode", __func__);
+		goto fail;
+	}
+
+	ok = 0;
+fail:
+	if (fp != NULL)
+		fclose(fp);
+
+	free(path);
+
+	return (ok);
+}
+
+/*
+ * Create and open a temporary file from the template tmp. The file is
+ * created exclusively by mkstemp(), so that a link planted in the cache
+ * directory is never followed. Where mkstemp() is not available, no file
+ * is created.
+ */
+static FILE *
+info_cache_tmp(char *tmp)
+{
+#ifdef HAVE_MKSTEMP
+	FILE	*fp;
+	int	 fd;
+
+	if ((fd = mkstemp(tmp)) < 0)
+		return (NULL);
+
+	if ((fp = fdopen(fd, "wb")) == NULL) {
+		(void)remove(tmp);
+		close(fd);
+	}
+
+	return (fp);
+#else
+	(void)tmp;
+
+	return (NULL);
+#endif
+}
+
+/*
+ * Record the device's getinfo reply. The entry is written to a temporary
+ * file first, so that a concurrent reader never sees a partial entry.
+ */
+void
+info_cache_store(fido_dev_t *dev, const unsigned char *reply, size_t len)
+{
+	info_cache_hdr_t	 hdr;
+	char			*path = NULL;
+	char			*tmp = NULL;
+	FILE			*fp = NULL;
+	bool			 ok = false;
+
+	if (len == 0 || len > INFO_CACHE_MAXLEN ||
+	    (path = info_cache_path(dev)) == NULL)
+		goto fail;
+
+	if ((tmp = calloc(1, strlen(path) + 8)) == NULL)
+		goto fail;
+
+	memcpy(tmp, path, strlen(path));
+	memcpy(tmp + strlen(path), ".XXXXXX", 7);
+
+	info_cache_hdr(dev, &hdr);
+	hdr.len = (uint16_t)len;
+
+	if ((fp = info_cache_tmp(tmp)) == NULL) {
+		log_debug("%s: info_cache_tmp %s", __func__, tmp);
+		free(tmp);
+		tmp = NULL; /* not ours to remove */
+		goto fail;
+	}
+
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	    fwrite(reply, len, 1, fp) != 1) {
+		log_debug("%s: write %s", __func__, tmp);
+		goto fail;
+	}
+
+	if (fclose(fp) != 0) {
+		fp = NULL;
+		log_debug("%s: fclose %s", __func__, tmp);
+		goto fail;
+	}
+
+	fp = NULL;
+
+	if (rename(tmp, path) != 0) {
+		log_debug("%s: rename %s", __func__, path);
+		goto fail;
+	}
+
+	ok = true;
+fail:
+	if (fp != NULL)
+		fclose(fp);
+
+	if (!ok && tmp != NULL)
+		remove(tmp);
+
+	free(path);
+	free(tmp);
+}
+
+/* Forget the device's entry, e.g. once its PIN has been changed. */
+void
+info_cache_remove(fido_dev_t *dev)
+{
+	char *path;
+
+	if ((path = info_cache_path(dev)) == NULL)
+		return;
+
+	(void)remove(path);
+	free(path);
+}
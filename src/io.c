@@ -6,6 +6,7 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "fido.h"
@@ -20,11 +21,11 @@ struct frame {
 			uint8_t cmd;
 			uint8_t bcnth;
 			uint8_t bcntl;
-			uint8_t data[CTAP_RPT_SIZE - 7];
+			uint8_t data[CTAP_MAX_RPT_SIZE - 7];
 		} init;
 		struct {
 			uint8_t seq;
-			uint8_t data[CTAP_RPT_SIZE - 5];
+			uint8_t data[CTAP_MAX_RPT_SIZE - 5];
 		} cont;
 	} body;
 })
@@ -33,129 +34,375 @@ struct frame {
 #define MIN(x, y) ((x) > (y) ? (y) : (x))
 #endif
 
+#ifndef MAX
+#define MAX(x, y) ((x) > (y) ? (x) : (y))
+#endif
+
+/*
+ * A frame occupies a whole report, whose length is a property of the
+ * device; these give the payload carried by an initialisation and a
+ * continuation frame in a report of len bytes.
+ */
+#define INIT_DATA_LEN(len)	((len) - 7)
+#define CONT_DATA_LEN(len)	((len) - 5)
+
+/*
+ * The largest payload that fits a CTAPHID message: one initialisation frame
+ * followed by up to 128 continuation frames, within the 16-bit length.
+ */
 static size_t
-tx_preamble(fido_dev_t *d,  uint8_t cmd, const void *buf, size_t count)
+tx_maxlen(const fido_dev_t *d)
 {
-	struct frame	*fp;
-	unsigned char	pkt[sizeof(*fp) + 1];
-	int		n;
+	return (MIN(UINT16_MAX, INIT_DATA_LEN(d->tx_len) +
+	    128 * CONT_DATA_LEN(d->tx_len)));
+}
 
-	if (d->io.write == NULL || (cmd & 0x80) == 0)
+static int
+io_buf_grow(fido_blob_t *b, size_t len)
+{
+	unsigned char *ptr;
+
+	if (b->len >= len)
 		return (0);
 
-	memset(&pkt, 0, sizeof(pkt));
-	fp = (struct frame *)(pkt + 1);
-	fp->cid = d->cid;
-	fp->body.init.cmd = 0x80 | cmd;
-	fp->body.init.bcnth = (count >> 8) & 0xff;
-	fp->body.init.bcntl = count & 0xff;
-	count = MIN(count, sizeof(fp->body.init.data));
-	memcpy(&fp->body.init.data, buf, count);
+	if ((ptr = realloc(b->ptr, len)) == NULL) {
+		log_debug("%s: realloc", __func__);
+		return (-1);
+	}
 
-	n = d->io.write(d->io_handle, pkt, sizeof(pkt));
-	if (n < 0 || (size_t)n != sizeof(pkt))
-		return (0);
+	b->ptr = ptr;
+	b->len = len;
 
-	return (count);
+	return (0);
 }
 
+/*
+ * Size the rx buffer for the largest message announced by the
+ * authenticator, so that replies are reassembled without reallocation.
+ * The length field of a CTAPHID frame caps the size at UINT16_MAX.
+ */
+void
+io_buf_reserve(fido_dev_t *d, uint64_t maxmsgsiz)
+{
+	if (maxmsgsiz > UINT16_MAX)
+		maxmsgsiz = UINT16_MAX;
+
+	if (io_buf_grow(&d->rx_buf, (size_t)maxmsgsiz) < 0)
+		log_debug("%s: io_buf_grow", __func__);
+}
+
+void
+io_buf_free(fido_dev_t *d)
+{
+	if (d->tx_buf.ptr != NULL) {
+		explicit_bzero(d->tx_buf.ptr, d->tx_buf.len);
+		free(d->tx_buf.ptr);
+	}
+
+	if (d->rx_buf.ptr != NULL) {
+		explicit_bzero(d->rx_buf.ptr, d->rx_buf.len);
+		free(d->rx_buf.ptr);
+	}
+
+	memset(&d->tx_buf, 0, sizeof(d->tx_buf));
+	memset(&d->rx_buf, 0, sizeof(d->rx_buf));
+}
+
+/*
+ * Lay out every report of a message back to back in the device's tx
+ * buffer, each prefixed by a zero report ID. Returns the number of
+ * reports, or 0 on error.
+ */
 static size_t
-tx_frame(fido_dev_t *d, int seq, const void *buf, size_t count)
+tx_build(fido_dev_t *d, uint8_t cmd, const unsigned char *buf, size_t count)
 {
+	const size_t	 stride = d->tx_len + 1;
+	const size_t	 cont_len = CONT_DATA_LEN(d->tx_len);
 	struct frame	*fp;
-	unsigned char	 pkt[sizeof(*fp) + 1];
-	int		 n;
+	unsigned char	*pkt;
+	size_t		 nreports;
+	size_t		 n;
+	uint8_t		 seq = 0;
+
+	n = MIN(count, INIT_DATA_LEN(d->tx_len));
+	nreports = 1 + (count - n + cont_len - 1) / cont_len;
 
-	if (d->io.write == NULL || seq < 0 || seq > UINT8_MAX)
+	if (io_buf_grow(&d->tx_buf, nreports * stride) < 0)
 		return (0);
 
-	memset(&pkt, 0, sizeof(pkt));
+	memset(d->tx_buf.ptr, 0, nreports * stride);
+
+	pkt = d->tx_buf.ptr;
 	fp = (struct frame *)(pkt + 1);
 	fp->cid = d->cid;
-	fp->body.cont.seq = (uint8_t)seq;
-	count = MIN(count, sizeof(fp->body.cont.data));
-	memcpy(&fp->body.cont.data, buf, count);
+	fp->body.init.cmd = 0x80 | cmd;
+	fp->body.init.bcnth = (count >> 8) & 0xff;
+	fp->body.init.bcntl = count & 0xff;
+	memcpy(&fp->body.init.data, buf, n);
+	buf += n;
+	count -= n;
 
-	n = d->io.write(d->io_handle, pkt, sizeof(pkt));
-	if (n < 0 || (size_t)n != sizeof(pkt))
-		return (0);
+	while (count > 0) {
+		pkt += stride;
+		fp = (struct frame *)(pkt + 1);
+		fp->cid = d->cid;
+		fp->body.cont.seq = seq++;
+		n = MIN(count, cont_len);
+		memcpy(&fp->body.cont.data, buf, n);
+		buf += n;
+		count -= n;
+	}
+
+	return (nreports);
+}
+
+static int
+tx_flush(fido_dev_t *d, size_t nreports)
+{
+	const size_t	stride = d->tx_len + 1;
+	int		n;
+
+	for (size_t i = 0; i < nreports; i++) {
+		n = d->io.write(d->io_handle, d->tx_buf.ptr + i * stride,
+		    stride);
+		if (n < 0 || (size_t)n != stride) {
+			log_debug("%s: write (report %zu)", __func__, i);
+			return (-1);
+		}
+	}
+
+	if (fido_time_now(&d->tx_time) != 0)
+		memset(&d->tx_time, 0, sizeof(d->tx_time));
 
-	return (count);
+	return (0);
 }
 
 int
 tx(fido_dev_t *d, uint8_t cmd, const void *buf, size_t count)
 {
-	int	seq = 0;
-	size_t	sent;
+	size_t nreports;
 
 	log_debug("%s: d=%p, cmd=0x%02x, buf=%p, count=%zu", __func__,
 	    (void *)d, cmd, buf, count);
 	log_xxd(buf, count);
 
-	if (d->io_handle == NULL || count > UINT16_MAX) {
-		log_debug("%s: invalid argument (%p, %zu)", __func__,
-		    d->io_handle, count);
+	if (d->io_handle == NULL || d->io.write == NULL || (cmd & 0x80) == 0 ||
+	    count > tx_maxlen(d)) {
+		log_debug("%s: invalid argument (%p, 0x%02x, %zu)", __func__,
+		    d->io_handle, cmd, count);
 		return (-1);
 	}
 
-	if ((sent = tx_preamble(d, cmd, buf, count)) == 0) {
-		log_debug("%s: tx_preamble", __func__);
+	if (fido_dev_cancelled(d)) {
+		log_debug("%s: cancelled", __func__);
 		return (-1);
 	}
 
-	while (sent < count) {
-		if (seq & 0x80) {
-			log_debug("%s: seq & 0x80", __func__);
-			return (-1);
-		}
-		const uint8_t *p = (const uint8_t *)buf + sent;
-		size_t n = tx_frame(d, seq++, p, count - sent);
-		if (n == 0) {
-			log_debug("%s: tx_frame", __func__);
-			return (-1);
-		}
-		sent += n;
+	if ((nreports = tx_build(d, cmd, buf, count)) == 0) {
+		log_debug("%s: tx_build", __func__);
+		return (-1);
 	}
 
-	return (0);
+	d->tx_nreports = nreports;
+
+	return (tx_flush(d, nreports));
 }
 
+/*
+ * Allocate a new channel and send the last message again on it, for when
+ * a resumed channel turns out to have been reclaimed by the authenticator.
+ * The message's reports are set aside while CTAPHID_INIT goes through the
+ * device's tx buffer.
+ */
 static int
-rx_frame(fido_dev_t *d, struct frame *fp, int ms)
+tx_replay(fido_dev_t *d, int *ms)
 {
-	int n;
+	const size_t	 stride = d->tx_len + 1;
+	fido_blob_t	 msg;
+	size_t		 nreports;
+	struct frame	*fp;
+	int		 ok = -1;
+
+	log_debug("%s: channel 0x%x reclaimed", __func__, d->cid);
+
+	msg = d->tx_buf;
+	nreports = d->tx_nreports;
+	memset(&d->tx_buf, 0, sizeof(d->tx_buf));
 
-	if (d->io.read == NULL)
+	if (fido_dev_reinit(d, ms) != FIDO_OK) {
+		log_debug("%s: fido_dev_reinit", __func__);
+		goto fail;
+	}
+
+	for (size_t i = 0; i < nreports; i++) {
+		fp = (struct frame *)(msg.ptr + i * stride + 1);
+		fp->cid = d->cid;
+	}
+
+	ok = 0;
+fail:
+	if (d->tx_buf.ptr != NULL) {
+		explicit_bzero(d->tx_buf.ptr, d->tx_buf.len);
+		free(d->tx_buf.ptr);
+	}
+
+	d->tx_buf = msg;
+	d->tx_nreports = nreports;
+
+	if (ok < 0)
 		return (-1);
 
-	n = d->io.read(d->io_handle, (unsigned char *)fp, sizeof(*fp), ms);
-	if (n < 0 || (size_t)n != sizeof(*fp))
+	return (tx_flush(d, nreports));
+}
+
+/*
+ * Send CTAPHID_CANCEL on the device's channel. The report is built on the
+ * stack rather than in the device's tx buffer, so this may be called while
+ * another thread is blocked on the device.
+ */
+int
+tx_cancel(fido_dev_t *d)
+{
+	unsigned char	 pkt[sizeof(frame_t) + 1];
+	struct frame	*fp;
+	int		 n;
+
+	if (d->io_handle == NULL || d->io.write == NULL ||
+	    d->tx_len > sizeof(frame_t)) {
+		log_debug("%s: invalid argument", __func__);
+		return (-1);
+	}
+
+	memset(pkt, 0, sizeof(pkt));
+	fp = (struct frame *)(pkt + 1);
+	fp->cid = d->cid;
+	fp->body.init.cmd = CTAP_FRAME_INIT | CTAP_CMD_CANCEL;
+
+	n = d->io.write(d->io_handle, pkt, d->tx_len + 1);
+	if (n < 0 || (size_t)n != d->tx_len + 1) {
+		log_debug("%s: write", __func__);
 		return (-1);
+	}
 
 	return (0);
 }
 
+/*
+ * Report the authenticator's status to the device's callback, if any,
+ * along with the number of milliseconds elapsed (-1 if unknown).
+ */
+void
+rx_status(fido_dev_t *d, uint8_t status, int ms)
+{
+	log_debug("%s: status=0x%02x, ms=%d", __func__, status, ms);
+
+	if (d->status_cb != NULL)
+		d->status_cb(d->status_arg, status, ms);
+}
+
+/*
+ * Keepalives carry no part of the reply; pass their status on and tell
+ * the caller to skip them.
+ */
+static bool
+rx_keepalive(fido_dev_t *d, const struct frame *fp)
+{
+	int ms;
+
+	if (fp->cid != d->cid ||
+	    fp->body.init.cmd != (CTAP_FRAME_INIT | CTAP_KEEPALIVE))
+		return (false);
+
+	if (fido_time_elapsed(&d->tx_time, &ms) != 0)
+		ms = -1;
+
+	rx_status(d, fp->body.init.data[0], ms);
+
+	return (true);
+}
+
+/*
+ * Read a frame, charging the time spent against *ms so that a message's
+ * frames and any keepalives share a single budget. Returns -1 on error, 0
+ * if no frame arrived within *ms, and 1 if one was read into fp.
+ */
 static int
-rx_preamble(fido_dev_t *d, struct frame *fp, int ms)
+rx_frame(fido_dev_t *d, struct frame *fp, int *ms)
 {
-	do {
-		if (rx_frame(d, fp, ms) < 0)
+	struct timespec	ts;
+	int		n;
+
+	if (d->io.read == NULL || d->rx_len > sizeof(*fp))
+		return (-1);
+
+	if (fido_time_now(&ts) != 0)
+		return (-1);
+
+	n = d->io.read(d->io_handle, (unsigned char *)fp, d->rx_len, *ms);
+
+	if (fido_time_delta(&ts, ms) != 0)
+		return (-1);
+
+	if (n == 0) {
+		log_debug("%s: nothing read", __func__);
+		if (*ms > 0)
+			*ms = 0; /* the budget is spent */
+		return (0);
+	}
+
+	if (n < 0 || (size_t)n != d->rx_len)
+		return (-1);
+
+	return (1);
+}
+
+/*
+ * Whether the authenticator rejected the request sent on a resumed
+ * channel; see fido_dev_set_resume().
+ */
+static bool
+rx_invalid_channel(const fido_dev_t *d, const struct frame *fp)
+{
+	return (d->resumed && fp->cid == d->cid &&
+	    fp->body.init.cmd == (CTAP_FRAME_INIT | CTAP_CMD_ERROR) &&
+	    fp->body.init.data[0] == CTAP_ERR_INVALID_CHANNEL);
+}
+
+static int
+rx_preamble(fido_dev_t *d, struct frame *fp, int *ms)
+{
+	for (;;) {
+		if (rx_frame(d, fp, ms) < 1)
 			return (-1);
 #ifdef FIDO_FUZZ
 		fp->cid = d->cid;
 #endif
-	} while (fp->cid == d->cid &&
-	    fp->body.init.cmd == (CTAP_FRAME_INIT | CTAP_KEEPALIVE));
+		if (rx_keepalive(d, fp))
+			continue;
+		if (rx_invalid_channel(d, fp) == false)
+			break;
+		if (tx_replay(d, ms) < 0)
+			return (-1);
+	}
+
+	d->resumed = false;
 
 	return (0);
 }
 
-int
-rx(fido_dev_t *d, uint8_t cmd, void *buf, size_t count, int ms)
+/*
+ * Reassemble a message into buf. If buf is NULL, the device's rx buffer is
+ * grown to the length announced in the initialisation frame and used
+ * instead. The time spent is charged against *ms, the budget left to the
+ * operation the message belongs to.
+ */
+static int
+rx_payload(fido_dev_t *d, uint8_t cmd, unsigned char *buf, size_t count,
+    int *ms)
 {
 	struct frame	f;
-	uint16_t	r;
+	size_t		r;
+	size_t		n;
 	uint16_t	flen;
 	int		seq;
 
@@ -171,8 +418,8 @@ rx(fido_dev_t *d, uint8_t cmd, void *buf, size_t count, int ms)
 	}
 
 	log_debug("%s: initiation frame at %p, len %zu", __func__, (void *)&f,
-	    sizeof(f));
-	log_xxd(&f, sizeof(f));
+	    d->rx_len);
+	log_xxd(&f, d->rx_len);
 
 #ifdef FIDO_FUZZ
 	f.cid = d->cid;
@@ -186,29 +433,33 @@ rx(fido_dev_t *d, uint8_t cmd, void *buf, size_t count, int ms)
 	}
 
 	flen = (f.body.init.bcnth << 8) | f.body.init.bcntl;
+
+	if (buf == NULL) {
+		if (io_buf_grow(&d->rx_buf, MAX(flen, CTAP_RPT_SIZE)) < 0)
+			return (-1);
+		buf = d->rx_buf.ptr;
+		count = d->rx_buf.len;
+	}
+
 	if (count < (size_t)flen) {
 		log_debug("%s: count < flen (%zu, %zu)", __func__, count,
 		    (size_t)flen);
 		return (-1);
 	}
-	if (flen < sizeof(f.body.init.data)) {
-		memcpy(buf, f.body.init.data, flen);
-		return (flen);
-	}
 
-	memcpy(buf, f.body.init.data, sizeof(f.body.init.data));
-	r = sizeof(f.body.init.data);
+	r = MIN(flen, INIT_DATA_LEN(d->rx_len));
+	memcpy(buf, f.body.init.data, r);
 	seq = 0;
 
-	while ((size_t)r < flen) {
-		if (rx_frame(d, &f, ms) < 0) {
+	while (r < flen) {
+		if (rx_frame(d, &f, ms) < 1) {
 			log_debug("%s: rx_frame", __func__);
 			return (-1);
 		}
 
 		log_debug("%s: continuation frame at %p, len %zu", __func__,
-		    (void *)&f, sizeof(f));
-		log_xxd(&f, sizeof(f));
+		    (void *)&f, d->rx_len);
+		log_xxd(&f, d->rx_len);
 
 #ifdef FIDO_FUZZ
 		f.cid = d->cid;
@@ -221,19 +472,146 @@ rx(fido_dev_t *d, uint8_t cmd, void *buf, size_t count, int ms)
 			return (-1);
 		}
 
-		uint8_t *p = (uint8_t *)buf + r;
+		n = MIN(flen - r, CONT_DATA_LEN(d->rx_len));
+		memcpy(buf + r, f.body.cont.data, n);
+		r += n;
+	}
+
+	log_debug("%s: payload at %p, len %zu", __func__, (void *)buf, r);
+	log_xxd(buf, r);
+
+	return ((int)r);
+}
+
+int
+rx(fido_dev_t *d, uint8_t cmd, void *buf, size_t count, int *ms)
+{
+	if (buf == NULL)
+		return (-1);
+
+	return (rx_payload(d, cmd, buf, count, ms));
+}
+
+/*
+ * Receive a message into the device's reusable rx buffer; on success,
+ * *ptr points to the payload, which remains valid until the next call.
+ */
+int
+rx_msg(fido_dev_t *d, uint8_t cmd, const unsigned char **ptr, int *ms)
+{
+	int n;
+
+	*ptr = NULL;
+
+	if ((n = rx_payload(d, cmd, NULL, 0, ms)) < 0)
+		return (-1);
+
+	*ptr = d->rx_buf.ptr;
+
+	return (n);
+}
 
-		if ((size_t)(flen - r) > sizeof(f.body.cont.data)) {
-			memcpy(p, f.body.cont.data, sizeof(f.body.cont.data));
-			r += sizeof(f.body.cont.data);
-		} else {
-			memcpy(p, f.body.cont.data, flen - r);
-			r += (flen - r); /* break */
+/*
+ * The error to report once rx() or rx_msg() has failed with *ms left: if
+ * the budget ran out, the authenticator took too long.
+ */
+int
+rx_error(const int *ms)
+{
+	return (*ms == 0 ? FIDO_ERR_USER_ACTION_TIMEOUT : FIDO_ERR_RX);
+}
+
+/*
+ * Prepare to reassemble a reply to cmd one report at a time, for callers
+ * that cannot block until the whole message has arrived.
+ */
+void
+rx_begin(fido_dev_t *d, uint8_t cmd)
+{
+	memset(&d->rx, 0, sizeof(d->rx));
+	d->rx.cmd = cmd;
+}
+
+/*
+ * Consume a single report, waiting at most ms for it. Returns -1 on error,
+ * 0 if no report arrived within ms, 1 if more reports are needed, and 2
+ * once the message is complete, in which case *ptr and *len describe the
+ * payload in the device's rx buffer.
+ */
+int
+rx_step(fido_dev_t *d, int ms, const unsigned char **ptr, size_t *len)
+{
+	struct frame	f;
+	size_t		n;
+	int		r;
+
+	*ptr = NULL;
+	*len = 0;
+
+	if (d->io_handle == NULL || (d->rx.cmd & 0x80) == 0) {
+		log_debug("%s: invalid argument (%p, 0x%02x)", __func__,
+		    d->io_handle, d->rx.cmd);
+		return (-1);
+	}
+
+	if ((r = rx_frame(d, &f, &ms)) < 1) {
+		log_debug("%s: rx_frame=%d", __func__, r);
+		return (r);
+	}
+
+	log_debug("%s: frame at %p, len %zu", __func__, (void *)&f,
+	    d->rx_len);
+	log_xxd(&f, d->rx_len);
+
+#ifdef FIDO_FUZZ
+	f.cid = d->cid;
+#endif
+
+	if (d->rx.init == false) {
+		if (rx_keepalive(d, &f))
+			return (1);
+#ifdef FIDO_FUZZ
+		f.body.init.cmd = d->rx.cmd;
+#endif
+		if (f.cid != d->cid || f.body.init.cmd != d->rx.cmd) {
+			log_debug("%s: cid (0x%x, 0x%x), cmd (0x%02x, 0x%02x)",
+			    __func__, f.cid, d->cid, f.body.init.cmd,
+			    d->rx.cmd);
+			return (-1);
 		}
+		d->rx.flen = (f.body.init.bcnth << 8) | f.body.init.bcntl;
+		if (io_buf_grow(&d->rx_buf, MAX(d->rx.flen,
+		    CTAP_RPT_SIZE)) < 0)
+			return (-1);
+		n = MIN(d->rx.flen, INIT_DATA_LEN(d->rx_len));
+		memcpy(d->rx_buf.ptr, f.body.init.data, n);
+		d->rx.init = true;
+	} else {
+#ifdef FIDO_FUZZ
+		f.body.cont.seq = d->rx.seq;
+#endif
+		if (f.cid != d->cid || f.body.cont.seq != d->rx.seq) {
+			log_debug("%s: cid (0x%x, 0x%x), seq (%d, %d)",
+			    __func__, f.cid, d->cid, f.body.cont.seq,
+			    d->rx.seq);
+			return (-1);
+		}
+		d->rx.seq++;
+		n = MIN(d->rx.flen - d->rx.r, CONT_DATA_LEN(d->rx_len));
+		memcpy(d->rx_buf.ptr + d->rx.r, f.body.cont.data, n);
 	}
 
-	log_debug("%s: payload at %p, len %zu", __func__, buf, (size_t)r);
-	log_xxd(buf, r);
+	d->rx.r += n;
+
+	if (d->rx.r < d->rx.flen)
+		return (1);
+
+	log_debug("%s: payload at %p, len %zu", __func__,
+	    (void *)d->rx_buf.ptr, d->rx.r);
+	log_xxd(d->rx_buf.ptr, d->rx.r);
+
+	*ptr = d->rx_buf.ptr;
+	*len = d->rx.r;
 
-	return (r);
+	return (2);
 }
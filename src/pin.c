@@ -4,7 +4,16 @@
  * license that can be found in the LICENSE file.
  */
 
+#include <openssl/rand.h>
+#include <openssl/sha.h>
+
+#ifdef HAVE_MLOCK
+#include <sys/mman.h>
+#endif
 #include <string.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
 #include "fido.h"
 #include "fido/es256.h"
 
@@ -73,22 +82,22 @@ fail:
 
 static int
 fido_dev_get_pin_token_rx(fido_dev_t *dev, const fido_blob_t *ecdh,
-    fido_blob_t *token, int ms)
+    fido_blob_t *token, int *ms)
 {
-	const uint8_t	 cmd = CTAP_FRAME_INIT | CTAP_CMD_CBOR;
-	fido_blob_t	*aes_token = NULL;
-	unsigned char	 reply[2048];
-	int		 reply_len;
-	int		 r;
+	const uint8_t		 cmd = CTAP_FRAME_INIT | CTAP_CMD_CBOR;
+	fido_blob_t		*aes_token = NULL;
+	const unsigned char	*reply;
+	int			 reply_len;
+	int			 r;
 
 	if ((aes_token = fido_blob_new()) == NULL) {
 		r = FIDO_ERR_INTERNAL;
 		goto fail;
 	}
 
-	if ((reply_len = rx(dev, cmd, &reply, sizeof(reply), ms)) < 0) {
+	if ((reply_len = rx_msg(dev, cmd, &reply, ms)) < 0) {
 		log_debug("%s: rx", __func__);
-		r = FIDO_ERR_RX;
+		r = rx_error(ms);
 		goto fail;
 	}
 
@@ -113,7 +122,7 @@ fail:
 
 static int
 fido_dev_get_pin_token_wait(fido_dev_t *dev, const char *pin,
-    const fido_blob_t *ecdh, const es256_pk_t *pk, fido_blob_t *token, int ms)
+    const fido_blob_t *ecdh, const es256_pk_t *pk, fido_blob_t *token, int *ms)
 {
 	int r;
 
@@ -126,9 +135,9 @@ fido_dev_get_pin_token_wait(fido_dev_t *dev, const char *pin,
 
 int
 fido_dev_get_pin_token(fido_dev_t *dev, const char *pin,
-    const fido_blob_t *ecdh, const es256_pk_t *pk, fido_blob_t *token)
+    const fido_blob_t *ecdh, const es256_pk_t *pk, fido_blob_t *token, int *ms)
 {
-	return (fido_dev_get_pin_token_wait(dev, pin, ecdh, pk, token, -1));
+	return (fido_dev_get_pin_token_wait(dev, pin, ecdh, pk, token, ms));
 }
 
 static int
@@ -159,7 +168,8 @@ pad64(const char *pin, fido_blob_t **ppin)
 }
 
 static int
-fido_dev_change_pin_tx(fido_dev_t *dev, const char *pin, const char *oldpin)
+fido_dev_change_pin_tx(fido_dev_t *dev, const char *pin, const char *oldpin,
+    int *ms)
 {
 	fido_blob_t	 f;
 	fido_blob_t	*ppin = NULL;
@@ -184,7 +194,7 @@ fido_dev_change_pin_tx(fido_dev_t *dev, const char *pin, const char *oldpin)
 		goto fail;
 	}
 
-	if ((r = fido_do_ecdh(dev, &pk, &ecdh)) != FIDO_OK) {
+	if ((r = fido_do_ecdh(dev, &pk, &ecdh, ms)) != FIDO_OK) {
 		log_debug("%s: fido_do_ecdh", __func__);
 		goto fail;
 	}
@@ -225,7 +235,7 @@ fail:
 }
 
 static int
-fido_dev_set_pin_tx(fido_dev_t *dev, const char *pin)
+fido_dev_set_pin_tx(fido_dev_t *dev, const char *pin, int *ms)
 {
 	fido_blob_t	 f;
 	fido_blob_t	*ppin = NULL;
@@ -242,7 +252,7 @@ fido_dev_set_pin_tx(fido_dev_t *dev, const char *pin)
 		goto fail;
 	}
 
-	if ((r = fido_do_ecdh(dev, &pk, &ecdh)) != FIDO_OK) {
+	if ((r = fido_do_ecdh(dev, &pk, &ecdh, ms)) != FIDO_OK) {
 		log_debug("%s: fido_do_ecdh", __func__);
 		goto fail;
 	}
@@ -280,15 +290,19 @@ fail:
 }
 
 static int
-fido_dev_set_pin_rx(fido_dev_t *dev, int ms)
+fido_dev_set_pin_rx(fido_dev_t *dev, int *ms)
 {
 	const uint8_t	cmd = CTAP_FRAME_INIT | CTAP_CMD_CBOR;
 	unsigned char	reply[512];
 	int		reply_len;
 
-	if ((reply_len = rx(dev, cmd, &reply, sizeof(reply), ms)) < 0 ||
-	    reply_len < 0 || (size_t)reply_len < 1) {
+	if ((reply_len = rx(dev, cmd, &reply, sizeof(reply), ms)) < 0) {
 		log_debug("%s: rx", __func__);
+		return (rx_error(ms));
+	}
+
+	if ((size_t)reply_len < 1) {
+		log_debug("%s: short reply", __func__);
 		return (FIDO_ERR_RX);
 	}
 
@@ -297,17 +311,23 @@ fido_dev_set_pin_rx(fido_dev_t *dev, int ms)
 
 static int
 fido_dev_set_pin_wait(fido_dev_t *dev, const char *pin, const char *oldpin,
-    int ms)
+    int *ms)
 {
 	int r;
 
+	/* clientPin may change */
+	fido_dev_cbor_info_reset(dev);
+	info_cache_remove(dev);
+	fido_dev_pin_session_reset(dev);
+
 	if (oldpin != NULL) {
-		if ((r = fido_dev_change_pin_tx(dev, pin, oldpin)) != FIDO_OK) {
+		if ((r = fido_dev_change_pin_tx(dev, pin, oldpin,
+		    ms)) != FIDO_OK) {
 			log_debug("%s: fido_dev_change_pin_tx", __func__);
 			return (r);
 		}
 	} else {
-		if ((r = fido_dev_set_pin_tx(dev, pin)) != FIDO_OK) {
+		if ((r = fido_dev_set_pin_tx(dev, pin, ms)) != FIDO_OK) {
 			log_debug("%s: fido_dev_set_pin_tx", __func__);
 			return (r);
 		}
@@ -324,7 +344,14 @@ fido_dev_set_pin_wait(fido_dev_t *dev, const char *pin, const char *oldpin,
 int
 fido_dev_set_pin(fido_dev_t *dev, const char *pin, const char *oldpin)
 {
-	return (fido_dev_set_pin_wait(dev, pin, oldpin, -1));
+	int ms = dev->timeout_ms;
+	int r;
+
+	r = fido_dev_set_pin_wait(dev, pin, oldpin, &ms);
+	/* the authenticator may have regenerated its key agreement key */
+	fido_dev_pin_session_reset(dev);
+
+	return (r);
 }
 
 static int
@@ -385,7 +412,7 @@ fail:
 }
 
 static int
-fido_dev_get_retry_count_rx(fido_dev_t *dev, int *retries, int ms)
+fido_dev_get_retry_count_rx(fido_dev_t *dev, int *retries, int *ms)
 {
 	const uint8_t	cmd = CTAP_FRAME_INIT | CTAP_CMD_CBOR;
 	unsigned char	reply[512];
@@ -396,7 +423,7 @@ fido_dev_get_retry_count_rx(fido_dev_t *dev, int *retries, int ms)
 
 	if ((reply_len = rx(dev, cmd, &reply, sizeof(reply), ms)) < 0) {
 		log_debug("%s: rx", __func__);
-		return (FIDO_ERR_RX);
+		return (rx_error(ms));
 	}
 
 	if ((r = parse_cbor_reply(reply, (size_t)reply_len, retries,
@@ -409,7 +436,7 @@ fido_dev_get_retry_count_rx(fido_dev_t *dev, int *retries, int ms)
 }
 
 static int
-fido_dev_get_retry_count_wait(fido_dev_t *dev, int *retries, int ms)
+fido_dev_get_retry_count_wait(fido_dev_t *dev, int *retries, int *ms)
 {
 	int r;
 
@@ -423,13 +450,246 @@ fido_dev_get_retry_count_wait(fido_dev_t *dev, int *retries, int ms)
 int
 fido_dev_get_retry_count(fido_dev_t *dev, int *retries)
 {
-	return (fido_dev_get_retry_count_wait(dev, retries, -1));
+	int ms = dev->timeout_ms;
+
+	return (fido_dev_get_retry_count_wait(dev, retries, &ms));
+}
+
+/*
+ * In session mode, the pinToken obtained for a PIN is kept with the open
+ * device, next to an HMAC of that PIN under a random key drawn for the
+ * token, so that further operations with the same PIN skip the key
+ * agreement and getPINToken exchanges. The token and key are locked in
+ * memory where the platform allows it, and wiped once the device reports
+ * a PIN error, its PIN is set or changed, it is reset, or closed. The
+ * shared secret from the key agreement (see ecdh.c) is kept alongside,
+ * and also wiped on any other error.
+ *
+ * Both live in dev->pin_mem, a page-aligned allocation of whole pages that
+ * is locked once and unlocked only when the session ends: page locks do
+ * not nest, so locking smaller objects would let the munlock() of one
+ * unlock a page still holding the other.
+ */
+#if defined(HAVE_MLOCK) && defined(HAVE_POSIX_MEMALIGN)
+#define PIN_MEM_LOCK
+#endif
+
+/* The memory backing dev's PIN session, allocated on first use. */
+fido_pin_mem_t *
+fido_dev_pin_mem(fido_dev_t *dev)
+{
+	void	*p;
+	size_t	 len;
+#ifdef PIN_MEM_LOCK
+	size_t	 pagesize;
+#endif
+
+	if (dev->pin_mem != NULL)
+		return (dev->pin_mem);
+
+#ifdef PIN_MEM_LOCK
+	pagesize = (size_t)getpagesize();
+	len = (sizeof(*dev->pin_mem) + pagesize - 1) / pagesize * pagesize;
+	if (posix_memalign(&p, pagesize, len) != 0) {
+		log_debug("%s: posix_memalign", __func__);
+		return (NULL);
+	}
+	memset(p, 0, len);
+	if (mlock(p, len) != 0)
+		log_debug("%s: mlock", __func__);
+#else
+	len = sizeof(*dev->pin_mem);
+	if ((p = calloc(1, len)) == NULL) {
+		log_debug("%s: calloc", __func__);
+		return (NULL);
+	}
+#endif
+	dev->pin_mem = p;
+	dev->pin_mem_len = len;
+
+	return (dev->pin_mem);
+}
+
+static void
+fido_dev_pin_mem_free(fido_dev_t *dev)
+{
+	if (dev->pin_mem == NULL)
+		return;
+
+	explicit_bzero(dev->pin_mem, dev->pin_mem_len);
+#ifdef PIN_MEM_LOCK
+	(void)munlock(dev->pin_mem, dev->pin_mem_len);
+#endif
+	free(dev->pin_mem);
+	dev->pin_mem = NULL;
+	dev->pin_mem_len = 0;
+}
+
+static int
+pin_hash(fido_pin_token_t *pt, const char *pin, unsigned char *dgst)
+{
+	fido_blob_t	 key;
+	fido_blob_t	*p = NULL;
+	int		 ok = -1;
+
+	key.ptr = pt->pin_key;
+	key.len = sizeof(pt->pin_key);
+
+	if ((p = fido_blob_new()) == NULL || fido_blob_set(p,
+	    (const unsigned char *)pin, strlen(pin)) < 0 ||
+	    fido_hmac_sha256(&key, p, NULL, dgst) < 0) {
+		log_debug("%s: fido_hmac_sha256", __func__);
+		goto fail;
+	}
+
+	ok = 0;
+fail:
+	fido_blob_free(&p);
+
+	return (ok);
+}
+
+static void
+fido_dev_pin_token_reset(fido_dev_t *dev)
+{
+	if (dev->pin_token == NULL)
+		return;
+
+	explicit_bzero(dev->pin_token, sizeof(*dev->pin_token));
+	dev->pin_token = NULL; /* lives in dev->pin_mem */
+}
+
+void
+fido_dev_pin_session_reset(fido_dev_t *dev)
+{
+	fido_dev_pin_token_reset(dev);
+	fido_dev_ecdh_reset(dev);
+	fido_dev_pin_mem_free(dev);
+}
+
+/*
+ * Called with the outcome of an operation: a PIN error invalidates the
+ * pinToken, and any error the shared secret, which the authenticator may
+ * have regenerated.
+ */
+void
+fido_dev_pin_session_check(fido_dev_t *dev, int r)
+{
+	if (r == FIDO_OK)
+		return;
+
+	if (r >= FIDO_ERR_PIN_INVALID && r <= FIDO_ERR_PIN_TOKEN_EXPIRED &&
+	    dev->pin_token != NULL) {
+		log_debug("%s: 0x%x, discarding pinToken", __func__, r);
+		fido_dev_pin_token_reset(dev);
+	}
+
+	fido_dev_ecdh_reset(dev);
+}
+
+/* Whether dev holds a pinToken or shared secret an operation may use. */
+bool
+fido_dev_pin_session_cached(const fido_dev_t *dev)
+{
+	return (dev->pin_token != NULL || dev->ecdh != NULL);
+}
+
+/*
+ * Whether an operation that may have used cached session state and failed
+ * with r is worth one more attempt with a new pinToken and shared secret.
+ * An authenticator that was power cycled, or reset by another host,
+ * regenerates both and rejects a pinAuth made with the old token, or an
+ * hmac-secret salt sealed with the old secret (extension errors 0xe0-0xef).
+ */
+bool
+fido_dev_pin_session_stale(int r)
+{
+	return (r == FIDO_ERR_PIN_AUTH_INVALID ||
+	    r == FIDO_ERR_PIN_TOKEN_EXPIRED || (r >= 0xe0 && r <= 0xef));
+}
+
+bool
+fido_dev_pin_token_cached(const fido_dev_t *dev, const char *pin)
+{
+	unsigned char	dgst[SHA256_DIGEST_LENGTH];
+	bool		ok;
+
+	if (dev->pin_token == NULL || pin_hash(dev->pin_token, pin, dgst) < 0)
+		return (false);
+
+	ok = timingsafe_bcmp(dgst, dev->pin_token->pin_hash,
+	    sizeof(dgst)) == 0;
+	explicit_bzero(dgst, sizeof(dgst));
+
+	return (ok);
+}
+
+static void
+pin_token_store(fido_dev_t *dev, const char *pin, const fido_blob_t *token)
+{
+	fido_pin_mem_t		*pm;
+	fido_pin_token_t	*pt;
+
+	fido_dev_pin_token_reset(dev);
+
+	if (dev->pin_session == false ||
+	    token->len > sizeof(pm->token.token) ||
+	    (pm = fido_dev_pin_mem(dev)) == NULL)
+		return;
+
+	pt = &pm->token;
+	if (RAND_bytes(pt->pin_key, sizeof(pt->pin_key)) != 1 ||
+	    pin_hash(pt, pin, pt->pin_hash) < 0) {
+		explicit_bzero(pt, sizeof(*pt));
+		return;
+	}
+
+	memcpy(pt->token, token->ptr, token->len);
+	pt->token_len = token->len;
+	dev->pin_token = pt;
+}
+
+/*
+ * Fill token with the pinToken for pin: the one kept by the PIN session,
+ * if any, or one obtained with the shared secret ecdh and our public key
+ * pk, which are then required.
+ */
+int
+fido_dev_pin_token_load(fido_dev_t *dev, const char *pin,
+    const es256_pk_t *pk, const fido_blob_t *ecdh, fido_blob_t *token,
+    int *ms)
+{
+	int r;
+
+	if (fido_dev_pin_token_cached(dev, pin)) {
+		if (fido_blob_set(token, dev->pin_token->token,
+		    dev->pin_token->token_len) < 0)
+			return (FIDO_ERR_INTERNAL);
+		return (FIDO_OK);
+	}
+
+	if (pk == NULL || ecdh == NULL) {
+		log_debug("%s: pk=%p, ecdh=%p", __func__, (const void *)pk,
+		    (const void *)ecdh);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	if ((r = fido_dev_get_pin_token(dev, pin, ecdh, pk, token,
+	    ms)) != FIDO_OK) {
+		log_debug("%s: fido_dev_get_pin_token", __func__);
+		fido_dev_pin_session_check(dev, r);
+		return (r);
+	}
+
+	pin_token_store(dev, pin, token);
+
+	return (FIDO_OK);
 }
 
 int
 add_cbor_pin_params(fido_dev_t *dev, const fido_blob_t *cdh,
     const es256_pk_t *pk, const fido_blob_t *ecdh, const char *pin,
-    cbor_item_t **auth, cbor_item_t **opt)
+    cbor_item_t **auth, cbor_item_t **opt, int *ms)
 {
 	fido_blob_t	*token = NULL;
 	int		 r;
@@ -439,8 +699,9 @@ add_cbor_pin_params(fido_dev_t *dev, const fido_blob_t *cdh,
 		goto fail;
 	}
 
-	if ((r = fido_dev_get_pin_token(dev, pin, ecdh, pk, token)) != FIDO_OK) {
-		log_debug("%s: fido_dev_get_pin_token", __func__);
+	if ((r = fido_dev_pin_token_load(dev, pin, pk, ecdh, token,
+	    ms)) != FIDO_OK) {
+		log_debug("%s: fido_dev_pin_token_load", __func__);
 		goto fail;
 	}
 
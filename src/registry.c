@@ -0,0 +1,274 @@
+/*
+ * Copyright (c) 2019 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#ifndef _WIN32
+#include <poll.h>
+#endif
+#include <string.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include "fido.h"
+
+#if defined(_MSC_VER)
+#define usleep(x)	Sleep((x)/1000)
+#endif
+
+/* maximum number of devices picked up by a scan */
+#define REGISTRY_MAX	64
+
+/* rescan interval when the platform provides no hotplug notifications */
+#define RESCAN_MS	1000
+
+fido_dev_registry_t *
+fido_dev_registry_new(void)
+{
+	return (calloc(1, sizeof(fido_dev_registry_t)));
+}
+
+void
+fido_dev_registry_free(fido_dev_registry_t **reg_p)
+{
+	fido_dev_registry_t *reg;
+
+	if (reg_p == NULL || (reg = *reg_p) == NULL)
+		return;
+
+	if (reg->monitor != NULL)
+		hid_monitor_close(reg->monitor);
+
+	fido_dev_info_free(&reg->devlist, reg->len);
+	free(reg);
+
+	*reg_p = NULL;
+}
+
+static void
+registry_notify(const fido_dev_registry_t *reg, int event,
+    const fido_dev_info_t *di)
+{
+	if (reg->cb != NULL)
+		reg->cb(reg->cb_arg, event, di);
+}
+
+static void
+info_reset(fido_dev_info_t *di)
+{
+	free(di->path);
+	free(di->manufacturer);
+	free(di->product);
+	memset(di, 0, sizeof(*di));
+}
+
+static fido_dev_info_t *
+registry_find(const fido_dev_registry_t *reg, const char *path)
+{
+	for (size_t i = 0; i < reg->len; i++)
+		if (strcmp(reg->devlist[i].path, path) == 0)
+			return (&reg->devlist[i]);
+
+	return (NULL);
+}
+
+/* Take ownership of *di and append it, unless the path is already known. */
+static int
+registry_add(fido_dev_registry_t *reg, fido_dev_info_t *di)
+{
+	fido_dev_info_t *ptr;
+
+	if (registry_find(reg, di->path) != NULL) {
+		info_reset(di);
+		return (0);
+	}
+
+	if ((ptr = recallocarray(reg->devlist, reg->len, reg->len + 1,
+	    sizeof(*ptr))) == NULL) {
+		info_reset(di);
+		return (-1);
+	}
+
+	reg->devlist = ptr;
+	reg->devlist[reg->len] = *di;
+	memset(di, 0, sizeof(*di));
+
+	registry_notify(reg, FIDO_DEV_ADDED, &reg->devlist[reg->len++]);
+
+	return (0);
+}
+
+static void
+registry_remove(fido_dev_registry_t *reg, const char *path)
+{
+	fido_dev_info_t	*di;
+	size_t		 i;
+
+	if ((di = registry_find(reg, path)) == NULL)
+		return; /* not a fido device */
+
+	registry_notify(reg, FIDO_DEV_REMOVED, di);
+	info_reset(di);
+
+	i = (size_t)(di - reg->devlist);
+	memmove(di, di + 1, (reg->len - i - 1) * sizeof(*di));
+	memset(&reg->devlist[--reg->len], 0, sizeof(*di));
+}
+
+/*
+ * Enumerate the devices currently present and reconcile the registry with
+ * them, notifying removals first and additions second.
+ */
+static int
+registry_scan(fido_dev_registry_t *reg)
+{
+	fido_dev_info_t	*devlist;
+	size_t		 n = 0;
+	size_t		 i = 0;
+	int		 r;
+
+	if ((devlist = fido_dev_info_new(REGISTRY_MAX)) == NULL)
+		return (FIDO_ERR_INTERNAL);
+
+	if ((r = fido_dev_info_manifest(devlist, REGISTRY_MAX,
+	    &n)) != FIDO_OK) {
+		log_debug("%s: fido_dev_info_manifest", __func__);
+		goto fail;
+	}
+
+	while (i < reg->len) {
+		bool found = false;
+		for (size_t j = 0; j < n && !found; j++)
+			found = strcmp(reg->devlist[i].path,
+			    devlist[j].path) == 0;
+		if (found)
+			i++;
+		else
+			registry_remove(reg, reg->devlist[i].path);
+	}
+
+	for (size_t j = 0; j < n; j++)
+		if (registry_add(reg, &devlist[j]) < 0) {
+			r = FIDO_ERR_INTERNAL;
+			goto fail;
+		}
+
+	r = FIDO_OK;
+fail:
+	fido_dev_info_free(&devlist, n);
+
+	return (r);
+}
+
+/*
+ * Subscribe to hotplug notifications, then scan for the devices already
+ * present; cb is invoked with FIDO_DEV_ADDED for each of them.
+ */
+int
+fido_dev_registry_open(fido_dev_registry_t *reg, fido_dev_registry_cb_t *cb,
+    void *cb_arg)
+{
+	if (reg->monitor != NULL || reg->len != 0)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	reg->cb = cb;
+	reg->cb_arg = cb_arg;
+
+	if ((reg->monitor = hid_monitor_open()) == NULL)
+		log_debug("%s: no hotplug monitor, rescanning", __func__);
+
+	return (registry_scan(reg));
+}
+
+int
+fido_dev_registry_fd(const fido_dev_registry_t *reg)
+{
+	if (reg->monitor == NULL)
+		return (-1);
+
+	return (hid_monitor_fd(reg->monitor));
+}
+
+#ifndef _WIN32
+static int
+registry_wait(int fd, int ms)
+{
+	struct pollfd pfd;
+
+	memset(&pfd, 0, sizeof(pfd));
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	if (poll(&pfd, 1, ms) < 0) {
+		log_debug("%s: poll", __func__);
+		return (-1);
+	}
+
+	return (0);
+}
+#else
+static int
+registry_wait(int fd, int ms)
+{
+	(void)fd;
+	(void)ms;
+
+	return (-1); /* no pollable descriptors */
+}
+#endif /* !_WIN32 */
+
+/*
+ * Wait up to ms milliseconds (-1 = indefinitely) for devices to come or go,
+ * and apply the changes. Without hotplug notifications, the registry sleeps
+ * for at most RESCAN_MS and rescans.
+ */
+int
+fido_dev_registry_update(fido_dev_registry_t *reg, int ms)
+{
+	fido_dev_info_t	di;
+	int		event;
+	int		r;
+
+	if (reg->monitor == NULL) {
+		if (ms < 0 || ms > RESCAN_MS)
+			ms = RESCAN_MS;
+		if (ms > 0)
+			usleep((unsigned)ms * 1000);
+		return (registry_scan(reg));
+	}
+
+	if (ms != 0 && registry_wait(hid_monitor_fd(reg->monitor), ms) < 0)
+		return (FIDO_ERR_INTERNAL);
+
+	while ((r = hid_monitor_next(reg->monitor, &event, &di)) == 1) {
+		if (event == FIDO_DEV_REMOVED) {
+			registry_remove(reg, di.path);
+			info_reset(&di);
+		} else if (registry_add(reg, &di) < 0)
+			return (FIDO_ERR_INTERNAL);
+	}
+
+	if (r < 0) {
+		log_debug("%s: hid_monitor_next", __func__);
+		return (FIDO_ERR_INTERNAL);
+	}
+
+	return (FIDO_OK);
+}
+
+size_t
+fido_dev_registry_len(const fido_dev_registry_t *reg)
+{
+	return (reg->len);
+}
+
+const fido_dev_info_t *
+fido_dev_registry_ptr(const fido_dev_registry_t *reg, size_t idx)
+{
+	if (idx >= reg->len)
+		return (NULL);
+
+	return (&reg->devlist[idx]);
+}
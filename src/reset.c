@@ -22,15 +22,19 @@ fido_dev_reset_tx(fido_dev_t *dev)
 }
 
 static int
-fido_dev_reset_rx(fido_dev_t *dev, int ms)
+fido_dev_reset_rx(fido_dev_t *dev, int *ms)
 {
-	const uint8_t	cmd = CTAP_FRAME_INIT | CTAP_CMD_CBOR;
-	unsigned char	reply[2048];
-	int		reply_len;
+	const uint8_t		 cmd = CTAP_FRAME_INIT | CTAP_CMD_CBOR;
+	const unsigned char	*reply;
+	int			 reply_len;
 
-	if ((reply_len = rx(dev, cmd, &reply, sizeof(reply), ms)) < 0 ||
-	    reply_len < 0 || (size_t)reply_len < 1) {
+	if ((reply_len = rx_msg(dev, cmd, &reply, ms)) < 0) {
 		log_debug("%s: rx", __func__);
+		return (rx_error(ms));
+	}
+
+	if ((size_t)reply_len < 1) {
+		log_debug("%s: short reply", __func__);
 		return (FIDO_ERR_RX);
 	}
 
@@ -38,10 +42,15 @@ fido_dev_reset_rx(fido_dev_t *dev, int ms)
 }
 
 static int
-fido_dev_reset_wait(fido_dev_t *dev, int ms)
+fido_dev_reset_wait(fido_dev_t *dev, int *ms)
 {
 	int r;
 
+	fido_dev_cbor_info_reset(dev);
+	info_cache_remove(dev);
+	fido_dev_pin_session_reset(dev);
+	fido_dev_hint_reset(dev);
+
 	if ((r = fido_dev_reset_tx(dev)) != FIDO_OK ||
 	    (r = fido_dev_reset_rx(dev, ms)) != FIDO_OK)
 		return (r);
@@ -52,5 +61,9 @@ fido_dev_reset_wait(fido_dev_t *dev, int ms)
 int
 fido_dev_reset(fido_dev_t *dev)
 {
-	return (fido_dev_reset_wait(dev, -1));
+	int ms = dev->timeout_ms;
+
+	fido_dev_op_begin(dev);
+
+	return (fido_dev_op_end(dev, fido_dev_reset_wait(dev, &ms)));
 }
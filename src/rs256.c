@@ -86,6 +86,45 @@ rs256_pk_decode(const cbor_item_t *item, rs256_pk_t *k)
 	return (0);
 }
 
+/*
+ * Canonical COSE_Key encoding of an RS256 public key, as emitted by
+ * authenticators: {1: 3, 3: -257, -1: n, -2: e}.
+ */
+static const unsigned char cose_rs256_n[] = {
+	0xa4, 0x01, 0x03, 0x03, 0x39, 0x01, 0x00, 0x20, 0x59, 0x01, 0x00,
+};
+
+static const unsigned char cose_rs256_e[] = {
+	0x21, 0x43,
+};
+
+/*
+ * Decode a COSE_Key in canonical form directly from buf. If the encoding
+ * differs in any way, buf is left untouched and -1 is returned so that the
+ * caller may fall back to cbor_load() and rs256_pk_decode().
+ */
+int
+rs256_pk_decode_fixed(const unsigned char **buf, size_t *len, rs256_pk_t *k)
+{
+	const unsigned char *p = *buf;
+
+	if (*len < RS256_PK_COSE_LEN ||
+	    memcmp(p, cose_rs256_n, sizeof(cose_rs256_n)) != 0 ||
+	    memcmp(p + sizeof(cose_rs256_n) + sizeof(k->n), cose_rs256_e,
+	    sizeof(cose_rs256_e)) != 0)
+		return (-1);
+
+	p += sizeof(cose_rs256_n);
+	memcpy(&k->n, p, sizeof(k->n));
+	p += sizeof(k->n) + sizeof(cose_rs256_e);
+	memcpy(&k->e, p, sizeof(k->e));
+
+	*buf += RS256_PK_COSE_LEN;
+	*len -= RS256_PK_COSE_LEN;
+
+	return (0);
+}
+
 rs256_pk_t *
 rs256_pk_new(void)
 {
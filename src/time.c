@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2019 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#include <limits.h>
+#include <time.h>
+#include "fido.h"
+
+static int
+timespec_to_ms(const struct timespec *ts)
+{
+	int64_t	x;
+	int64_t	y;
+
+	if (ts->tv_sec < 0 || ts->tv_nsec < 0 ||
+	    ts->tv_nsec >= 1000000000LL)
+		return (-1);
+
+	if ((uint64_t)ts->tv_sec >= INT64_MAX / 1000LL)
+		return (-1);
+
+	x = (int64_t)ts->tv_sec * 1000LL;
+	y = (int64_t)ts->tv_nsec / 1000000LL;
+
+	if (INT64_MAX - x < y || x + y > INT_MAX)
+		return (-1);
+
+	return ((int)(x + y));
+}
+
+int
+fido_time_now(struct timespec *ts_now)
+{
+	if (clock_gettime(CLOCK_MONOTONIC, ts_now) != 0) {
+		log_debug("%s: clock_gettime", __func__);
+		return (-1);
+	}
+
+	return (0);
+}
+
+/*
+ * Store in *ms the number of milliseconds elapsed since ts_start.
+ */
+int
+fido_time_elapsed(const struct timespec *ts_start, int *ms)
+{
+	struct timespec	ts_end;
+	struct timespec	ts_delta;
+
+	if (fido_time_now(&ts_end) != 0)
+		return (-1);
+
+	if (ts_end.tv_sec < ts_start->tv_sec ||
+	    (ts_end.tv_sec == ts_start->tv_sec &&
+	    ts_end.tv_nsec < ts_start->tv_nsec)) {
+		log_debug("%s: clock went backwards", __func__);
+		return (-1);
+	}
+
+	ts_delta.tv_sec = ts_end.tv_sec - ts_start->tv_sec;
+	ts_delta.tv_nsec = ts_end.tv_nsec - ts_start->tv_nsec;
+	if (ts_delta.tv_nsec < 0) {
+		ts_delta.tv_sec--;
+		ts_delta.tv_nsec += 1000000000L;
+	}
+
+	if ((*ms = timespec_to_ms(&ts_delta)) < 0) {
+		log_debug("%s: timespec_to_ms", __func__);
+		return (-1);
+	}
+
+	return (0);
+}
+
+/*
+ * Charge the time elapsed since ts_start against *ms_remain, which is left
+ * alone if negative (no deadline) and never drops below zero.
+ */
+int
+fido_time_delta(const struct timespec *ts_start, int *ms_remain)
+{
+	int ms;
+
+	if (*ms_remain < 0)
+		return (0);
+
+	if (fido_time_elapsed(ts_start, &ms) != 0)
+		return (-1);
+
+	if (ms > *ms_remain)
+		ms = *ms_remain;
+
+	*ms_remain -= ms;
+
+	return (0);
+}
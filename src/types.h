@@ -106,6 +106,7 @@ typedef struct fido_assert {
 	char              *rp_id;        /* relying party id */
 	fido_blob_t        cdh;          /* client data hash */
 	fido_blob_t        hmac_salt;    /* optional hmac-secret salt */
+	fido_blob_t        hmac_salt2;   /* optional second salt */
 	fido_blob_array_t  allow_list;   /* list of allowed credentials */
 	fido_opt_t         up;           /* user presence */
 	fido_opt_t         uv;           /* user verification */
@@ -138,6 +139,8 @@ typedef struct fido_cbor_info {
 	fido_opt_array_t  options;    /* list of supported options */
 	uint64_t          maxmsgsiz;  /* maximum message size */
 	fido_byte_array_t protocols;  /* supported pin protocols */
+	uint64_t          maxcredcntlst; /* max credentials in a list */
+	uint64_t          maxcredidlen;  /* max credential id length */
 } fido_cbor_info_t;
 
 typedef struct fido_dev_info {
@@ -160,12 +163,99 @@ struct fido_ctap_info {
 	uint8_t  flags;    /* capabilities flags; see FIDO_CAP_* */
 })
 
+/* incremental reassembly of a CTAPHID reply */
+typedef struct fido_rx_state {
+	uint8_t	cmd;  /* expected command */
+	bool	init; /* initialisation frame received */
+	size_t	flen; /* announced payload length */
+	size_t	r;    /* payload bytes received */
+	int	seq;  /* expected continuation sequence */
+} fido_rx_state_t;
+
+struct fido_dev;
+
+/* completes an asynchronous operation once its reply, if any, has arrived */
+typedef int fido_async_cb_t(struct fido_dev *, void *, const unsigned char *,
+    size_t);
+
+typedef struct fido_async {
+	fido_async_cb_t	*cb;   /* reply handler; NULL if idle */
+	void		*arg;  /* object being filled in */
+	fido_blob_t	*ecdh; /* shared secret, if any */
+	bool		 ready; /* complete without a reply */
+} fido_async_t;
+
+typedef struct fido_pin_token {
+	unsigned char	pin_key[32];  /* random key of pin_hash */
+	unsigned char	pin_hash[32]; /* hmac of the unlocking pin */
+	unsigned char	token[64];    /* decrypted pinToken */
+	size_t		token_len;    /* length of the pinToken */
+} fido_pin_token_t;
+
+typedef struct fido_ecdh_cache {
+	es256_pk_t	pk;         /* our public key */
+	unsigned char	secret[32]; /* shared secret (sha256 of point) */
+} fido_ecdh_cache_t;
+
+typedef struct fido_pin_mem {
+	fido_pin_token_t	token; /* backs dev->pin_token */
+	fido_ecdh_cache_t	ecdh;  /* backs dev->ecdh */
+} fido_pin_mem_t;
+
+typedef struct fido_cred_hint {
+	unsigned char	rp_id_hash[32]; /* sha256 of the rp id */
+	fido_blob_t	id;             /* credential id */
+} fido_cred_hint_t;
+
 typedef struct fido_dev {
 	uint64_t          nonce;     /* issued nonce */
 	fido_ctap_info_t  attr;      /* device attributes */
 	uint32_t          cid;       /* assigned channel id */
 	void		 *io_handle; /* abstract i/o handle */
 	fido_dev_io_t	  io;        /* i/o functions & data */
+	fido_blob_t	  tx_buf;    /* outgoing reports, reused */
+	fido_blob_t	  rx_buf;    /* reassembled reply, reused */
+	size_t		  rx_len;    /* input report length */
+	size_t		  tx_len;    /* output report length */
+	int		  timeout_ms; /* per operation; -1 = none */
+	fido_rx_state_t	  rx;        /* reassembly state (async) */
+	fido_async_t	  async;     /* pending operation (async) */
+	fido_dev_status_cb_t *status_cb; /* keepalive callback */
+	void		 *status_arg; /* opaque callback argument */
+	struct timespec	  tx_time;   /* when the last request was sent */
+	volatile long	  op;        /* cancellable op state; see dev.c */
+	char		 *path;      /* path of the last successful open */
+	bool		  resume;    /* reuse the channel when reopening */
+	bool		  resumed;   /* reused channel not yet confirmed */
+	size_t		  tx_nreports; /* reports in tx_buf */
+	fido_cbor_info_t *info;      /* cached getinfo; NULL = not fetched */
+	int		  info_opt;  /* FIDO_OPTION_* reported by getinfo */
+	int		  info_opt_true; /* FIDO_OPTION_* set to true */
+	char		 *info_cache_dir; /* on-disk getinfo cache */
+	char		 *serial;    /* hid serial number; NULL = unknown */
+	bool		  pin_session; /* keep the pinToken between ops */
+	fido_pin_token_t *pin_token; /* cached pinToken; NULL = none */
+	fido_ecdh_cache_t *ecdh;     /* cached key agreement; NULL = none */
+	fido_pin_mem_t	 *pin_mem;   /* locked pages holding the above */
+	size_t		  pin_mem_len; /* length of pin_mem */
+	int		  u2f_poll_min; /* first u2f poll delay; 0 = 10 ms */
+	int		  u2f_poll_max; /* u2f poll delay cap, ms; 0 = 100 */
+	fido_cred_hint_t *hint;      /* credentials last used, mru first */
+	size_t		  hint_len;  /* number of hints */
+	size_t		  hint_max;  /* hints to keep; 0 = none */
 } fido_dev_t;
 
+typedef struct fido_dev_set {
+	fido_dev_t	**dev; /* open devices */
+	size_t		  len; /* number of devices */
+} fido_dev_set_t;
+
+typedef struct fido_dev_registry {
+	fido_dev_info_t		*devlist; /* devices currently present */
+	size_t			 len;     /* number of devices */
+	void			*monitor; /* hotplug monitor; NULL = rescan */
+	fido_dev_registry_cb_t	*cb;      /* change callback */
+	void			*cb_arg;  /* opaque callback argument */
+} fido_dev_registry_t;
+
 #endif /* !_TYPES_H */
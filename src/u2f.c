@@ -4,6 +4,7 @@
  * license that can be found in the LICENSE file.
  */
 
+#include <openssl/evp.h>
 #include <openssl/sha.h>
 #include <openssl/x509.h>
 
@@ -116,15 +117,113 @@ authdata_fake(const char *rp_id, uint8_t flags, uint32_t sigcount,
 	return (0);
 }
 
+/* delays between U2F user presence polls, in milliseconds */
+#define U2F_POLL_MIN_MS	10
+#define U2F_POLL_MAX_MS	100
+
+typedef struct u2f_poll {
+	struct timespec	t0;    /* start of the wait */
+	struct timespec	ts;    /* start of the last delay */
+	int		delay; /* next delay, ms */
+	int		cap;   /* maximum delay, ms */
+	unsigned	n;     /* number of polls */
+} u2f_poll_t;
+
 static int
-send_dummy_register(fido_dev_t *dev, int ms)
+u2f_poll_begin(const fido_dev_t *dev, u2f_poll_t *up)
 {
-	const uint8_t	 cmd = CTAP_FRAME_INIT | CTAP_CMD_MSG;
-	iso7816_apdu_t	*apdu = NULL;
-	unsigned char	 challenge[SHA256_DIGEST_LENGTH];
-	unsigned char	 application[SHA256_DIGEST_LENGTH];
-	unsigned char	 reply[2048];
-	int		 r;
+	memset(up, 0, sizeof(*up));
+
+	if (fido_time_now(&up->ts) != 0)
+		return (-1);
+
+	up->t0 = up->ts;
+	up->delay = dev->u2f_poll_min > 0 ? dev->u2f_poll_min :
+	    U2F_POLL_MIN_MS;
+	up->cap = dev->u2f_poll_max > 0 ? dev->u2f_poll_max :
+	    U2F_POLL_MAX_MS;
+	if (up->delay > up->cap)
+		up->delay = up->cap;
+
+	return (0);
+}
+
+/*
+ * Wait before polling a U2F authenticator for user presence again. The
+ * delay is charged against *ms, as rx() charged the exchange just
+ * completed. Returns -1 once the budget is exhausted or the operation has
+ * been cancelled. U2F has no keepalives, so the device's status callback is
+ * told here that the authenticator is waiting for the user, with the time
+ * elapsed since up->t0. The first delay is short, so that a user who is
+ * already touching the authenticator is not kept waiting; it then doubles
+ * with each poll up to up->cap, to keep the bus quiet during long waits.
+ */
+static int
+u2f_poll_delay(fido_dev_t *dev, u2f_poll_t *up, int *ms)
+{
+	int delay = up->delay;
+	int elapsed;
+
+	if (fido_time_elapsed(&up->t0, &elapsed) != 0)
+		elapsed = -1;
+
+	rx_status(dev, CTAP_KEEPALIVE_UPNEEDED, elapsed);
+
+	if (fido_dev_cancelled(dev) || *ms == 0 ||
+	    fido_time_now(&up->ts) != 0)
+		return (-1);
+
+	if (*ms != -1 && *ms < delay)
+		delay = *ms;
+
+	up->n++;
+	up->delay = up->delay > up->cap / 2 ? up->cap : up->delay * 2;
+
+#ifndef FIDO_FUZZ
+	usleep((unsigned)delay * 1000);
+#endif
+
+	if (fido_time_delta(&up->ts, ms) != 0)
+		return (-1);
+
+	return (fido_dev_cancelled(dev) ? -1 : 0);
+}
+
+static void
+u2f_poll_done(const u2f_poll_t *up)
+{
+	int elapsed;
+
+	if (fido_time_elapsed(&up->t0, &elapsed) != 0)
+		elapsed = -1;
+
+	log_debug("%s: %u polls, %d ms", __func__, up->n, elapsed);
+}
+
+static int
+u2f_poll_error(fido_dev_t *dev)
+{
+	if (fido_dev_cancelled(dev)) {
+		log_debug("%s: cancelled", __func__);
+		return (FIDO_ERR_KEEPALIVE_CANCEL);
+	}
+
+	log_debug("%s: timeout", __func__);
+
+	return (FIDO_ERR_USER_ACTION_TIMEOUT);
+}
+
+static int
+send_dummy_register(fido_dev_t *dev, int *ms)
+{
+	const uint8_t		 cmd = CTAP_FRAME_INIT | CTAP_CMD_MSG;
+	iso7816_apdu_t		*apdu = NULL;
+	unsigned char		 challenge[SHA256_DIGEST_LENGTH];
+	unsigned char		 application[SHA256_DIGEST_LENGTH];
+	const unsigned char	*reply;
+	u2f_poll_t		 up;
+	int			 reply_len;
+	int			 r;
 
 	/* dummy challenge & application */
 	memset(&challenge, 0xff, sizeof(challenge));
@@ -139,21 +238,31 @@ send_dummy_register(fido_dev_t *dev, int ms)
 		goto fail;
 	}
 
+	if (u2f_poll_begin(dev, &up) != 0) {
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+
 	do {
 		if (tx(dev, cmd, iso7816_ptr(apdu), iso7816_len(apdu)) < 0) {
 			log_debug("%s: tx", __func__);
 			r = FIDO_ERR_TX;
 			goto fail;
 		}
-		if (rx(dev, cmd, &reply, sizeof(reply), ms) < 2) {
+		if ((reply_len = rx_msg(dev, cmd, &reply, ms)) < 2) {
 			log_debug("%s: rx", __func__);
-			r = FIDO_ERR_RX;
+			r = reply_len < 0 ? rx_error(ms) : FIDO_ERR_RX;
 			goto fail;
 		}
-#ifndef FIDO_FUZZ
-		usleep((ms == -1 ? 100 : ms) * 1000);
-#endif
-	} while (((reply[0] << 8) | reply[1]) == SW_CONDITIONS_NOT_SATISFIED);
+	} while (((reply[0] << 8) | reply[1]) == SW_CONDITIONS_NOT_SATISFIED &&
+	    u2f_poll_delay(dev, &up, ms) == 0);
+
+	u2f_poll_done(&up);
+
+	if (((reply[0] << 8) | reply[1]) == SW_CONDITIONS_NOT_SATISFIED) {
+		r = u2f_poll_error(dev);
+		goto fail;
+	}
 
 	r = FIDO_OK;
 fail:
@@ -163,74 +272,119 @@ fail:
 }
 
 static int
-key_lookup(fido_dev_t *dev, const char *rp_id, const fido_blob_t *key_id,
-    int *found, int ms)
+rp_id_hash_get(const char *rp_id, unsigned char *rp_id_hash)
+{
+	if (rp_id == NULL || EVP_Digest(rp_id, strlen(rp_id), rp_id_hash,
+	    NULL, fido_evp_sha256(), NULL) == 0) {
+		log_debug("%s: sha256", __func__);
+		return (-1);
+	}
+
+	return (0);
+}
+
+static iso7816_apdu_t *
+auth_apdu(uint8_t p1, const unsigned char *challenge,
+    const unsigned char *rp_id_hash, const fido_blob_t *key_id)
+{
+	iso7816_apdu_t	*apdu;
+	uint8_t		 key_id_len;
+
+	if (key_id->len > UINT8_MAX)
+		return (NULL);
+
+	key_id_len = (uint8_t)key_id->len;
+
+	if ((apdu = iso7816_new(U2F_CMD_AUTH, p1, 2 * SHA256_DIGEST_LENGTH +
+	    sizeof(key_id_len) + key_id_len)) == NULL ||
+	    iso7816_add(apdu, challenge, SHA256_DIGEST_LENGTH) < 0 ||
+	    iso7816_add(apdu, rp_id_hash, SHA256_DIGEST_LENGTH) < 0 ||
+	    iso7816_add(apdu, &key_id_len, sizeof(key_id_len)) < 0 ||
+	    iso7816_add(apdu, key_id->ptr, key_id_len) < 0) {
+		log_debug("%s: iso7816", __func__);
+		iso7816_free(&apdu);
+		return (NULL);
+	}
+
+	return (apdu);
+}
+
+/*
+ * Look for the first of the n key handles in key_id that the authenticator
+ * recognises under rp_id_hash, and store its index in *idx; *idx is set to
+ * n if there is none. CTAPHID allows a single outstanding request per
+ * channel, so the check-only APDU for the next handle is built while the
+ * device processes the current one.
+ */
+static int
+key_lookup(fido_dev_t *dev, const unsigned char *rp_id_hash,
+    const fido_blob_t *key_id, size_t n, size_t *idx, int *ms)
 {
 	const uint8_t	 cmd = CTAP_FRAME_INIT | CTAP_CMD_MSG;
 	iso7816_apdu_t	*apdu = NULL;
+	iso7816_apdu_t	*next = NULL;
 	unsigned char	 challenge[SHA256_DIGEST_LENGTH];
-	unsigned char	 rp_id_hash[SHA256_DIGEST_LENGTH];
 	unsigned char	 reply[8];
-	uint8_t		 key_id_len;
+	int		 reply_len;
 	int		 r;
 
-	if (key_id->len > UINT8_MAX || rp_id == NULL) {
-		log_debug("%s: key_id->len=%zu, rp_id=%p", __func__,
-		    key_id->len, (const void *)rp_id);
-		r = FIDO_ERR_INVALID_ARGUMENT;
-		goto fail;
-	}
+	*idx = n;
+
+	for (size_t i = 0; i < n; i++)
+		if (key_id[i].len > UINT8_MAX) {
+			log_debug("%s: key_id[%zu].len=%zu", __func__, i,
+			    key_id[i].len);
+			return (FIDO_ERR_INVALID_ARGUMENT);
+		}
 
 	memset(&challenge, 0xff, sizeof(challenge));
-	memset(&rp_id_hash, 0, sizeof(rp_id_hash));
 
-	if (SHA256((const void *)rp_id, strlen(rp_id),
-	    rp_id_hash) != rp_id_hash) {
-		log_debug("%s: sha256", __func__);
+	if (n > 0 && (apdu = auth_apdu(U2F_AUTH_CHECK, challenge, rp_id_hash,
+	    &key_id[0])) == NULL) {
 		r = FIDO_ERR_INTERNAL;
 		goto fail;
 	}
 
-	key_id_len = (uint8_t)key_id->len;
-
-	if ((apdu = iso7816_new(U2F_CMD_AUTH, U2F_AUTH_CHECK, 2 *
-	    SHA256_DIGEST_LENGTH + sizeof(key_id_len) + key_id_len)) == NULL ||
-	    iso7816_add(apdu, &challenge, sizeof(challenge)) < 0 ||
-	    iso7816_add(apdu, &rp_id_hash, sizeof(rp_id_hash)) < 0 ||
-	    iso7816_add(apdu, &key_id_len, sizeof(key_id_len)) < 0 ||
-	    iso7816_add(apdu, key_id->ptr, key_id_len) < 0) {
-		log_debug("%s: iso7816", __func__);
-		r = FIDO_ERR_INTERNAL;
-		goto fail;
-	}
+	for (size_t i = 0; i < n; i++) {
+		if (tx(dev, cmd, iso7816_ptr(apdu), iso7816_len(apdu)) < 0) {
+			log_debug("%s: tx", __func__);
+			r = FIDO_ERR_TX;
+			goto fail;
+		}
+		if (i + 1 < n && (next = auth_apdu(U2F_AUTH_CHECK, challenge,
+		    rp_id_hash, &key_id[i + 1])) == NULL) {
+			r = FIDO_ERR_INTERNAL;
+			goto fail;
+		}
+		if ((reply_len = rx(dev, cmd, &reply, sizeof(reply),
+		    ms)) != 2) {
+			log_debug("%s: rx", __func__);
+			r = reply_len < 0 ? rx_error(ms) : FIDO_ERR_RX;
+			goto fail;
+		}
 
-	if (tx(dev, cmd, iso7816_ptr(apdu), iso7816_len(apdu)) < 0) {
-		log_debug("%s: tx", __func__);
-		r = FIDO_ERR_TX;
-		goto fail;
-	}
-	if (rx(dev, cmd, &reply, sizeof(reply), ms) != 2) {
-		log_debug("%s: rx", __func__);
-		r = FIDO_ERR_RX;
-		goto fail;
-	}
+		switch ((reply[0] << 8) | reply[1]) {
+		case SW_CONDITIONS_NOT_SATISFIED:
+			*idx = i; /* key exists */
+			r = FIDO_OK;
+			goto fail;
+		case SW_WRONG_DATA:
+			break; /* key does not exist */
+		default:
+			/* unexpected sw */
+			r = FIDO_ERR_INTERNAL;
+			goto fail;
+		}
 
-	switch ((reply[0] << 8) | reply[1]) {
-	case SW_CONDITIONS_NOT_SATISFIED:
-		*found = 1; /* key exists */
-		break;
-	case SW_WRONG_DATA:
-		*found = 0; /* key does not exist */
-		break;
-	default:
-		/* unexpected sw */
-		r = FIDO_ERR_INTERNAL;
-		goto fail;
+		iso7816_free(&apdu);
+		apdu = next;
+		next = NULL;
 	}
 
 	r = FIDO_OK;
 fail:
 	iso7816_free(&apdu);
+	iso7816_free(&next);
 
 	return (r);
 }
@@ -270,15 +424,15 @@ parse_auth_reply(fido_blob_t *sig, fido_blob_t *ad, const char *rp_id,
 
 static int
 do_auth(fido_dev_t *dev, const fido_blob_t *cdh, const char *rp_id,
-    const fido_blob_t *key_id, fido_blob_t *sig, fido_blob_t *ad, int ms)
+    const unsigned char *rp_id_hash, const fido_blob_t *key_id,
+    fido_blob_t *sig, fido_blob_t *ad, int *ms)
 {
-	const uint8_t	 cmd = CTAP_FRAME_INIT | CTAP_CMD_MSG;
-	iso7816_apdu_t	*apdu = NULL;
-	unsigned char	 rp_id_hash[SHA256_DIGEST_LENGTH];
-	unsigned char	 reply[128];
-	int		 reply_len;
-	uint8_t		 key_id_len;
-	int		 r;
+	const uint8_t		 cmd = CTAP_FRAME_INIT | CTAP_CMD_MSG;
+	iso7816_apdu_t		*apdu = NULL;
+	const unsigned char	*reply;
+	u2f_poll_t		 up;
+	int			 reply_len;
+	int			 r;
 
 	if (cdh->len != SHA256_DIGEST_LENGTH || key_id->len > UINT8_MAX ||
 	    rp_id == NULL) {
@@ -286,24 +440,13 @@ do_auth(fido_dev_t *dev, const fido_blob_t *cdh, const char *rp_id,
 		goto fail;
 	}
 
-	memset(&rp_id_hash, 0, sizeof(rp_id_hash));
-
-	if (SHA256((const void *)rp_id, strlen(rp_id),
-	    rp_id_hash) != rp_id_hash) {
-		log_debug("%s: sha256", __func__);
+	if ((apdu = auth_apdu(U2F_AUTH_SIGN, cdh->ptr, rp_id_hash,
+	    key_id)) == NULL) {
 		r = FIDO_ERR_INTERNAL;
 		goto fail;
 	}
 
-	key_id_len = (uint8_t)key_id->len;
-
-	if ((apdu = iso7816_new(U2F_CMD_AUTH, U2F_AUTH_SIGN, 2 *
-	    SHA256_DIGEST_LENGTH + sizeof(key_id_len) + key_id_len)) == NULL ||
-	    iso7816_add(apdu, cdh->ptr, cdh->len) < 0 ||
-	    iso7816_add(apdu, &rp_id_hash, sizeof(rp_id_hash)) < 0 ||
-	    iso7816_add(apdu, &key_id_len, sizeof(key_id_len)) < 0 ||
-	    iso7816_add(apdu, key_id->ptr, key_id_len) < 0) {
-		log_debug("%s: iso7816", __func__);
+	if (u2f_poll_begin(dev, &up) != 0) {
 		r = FIDO_ERR_INTERNAL;
 		goto fail;
 	}
@@ -314,15 +457,20 @@ do_auth(fido_dev_t *dev, const fido_blob_t *cdh, const char *rp_id,
 			r = FIDO_ERR_TX;
 			goto fail;
 		}
-		if ((reply_len = rx(dev, cmd, &reply, sizeof(reply), ms)) < 2) {
+		if ((reply_len = rx_msg(dev, cmd, &reply, ms)) < 2) {
 			log_debug("%s: rx", __func__);
-			r = FIDO_ERR_RX;
+			r = reply_len < 0 ? rx_error(ms) : FIDO_ERR_RX;
 			goto fail;
 		}
-#ifndef FIDO_FUZZ
-		usleep((ms == -1 ? 100 : ms) * 1000);
-#endif
-	} while (((reply[0] << 8) | reply[1]) == SW_CONDITIONS_NOT_SATISFIED);
+	} while (((reply[0] << 8) | reply[1]) == SW_CONDITIONS_NOT_SATISFIED &&
+	    u2f_poll_delay(dev, &up, ms) == 0);
+
+	u2f_poll_done(&up);
+
+	if (((reply[0] << 8) | reply[1]) == SW_CONDITIONS_NOT_SATISFIED) {
+		r = u2f_poll_error(dev);
+		goto fail;
+	}
 
 	if ((r = parse_auth_reply(sig, ad, rp_id, reply,
 	    (size_t)reply_len)) != FIDO_OK) {
@@ -341,8 +489,6 @@ cbor_blob_from_ec_point(const uint8_t *ec_point, size_t ec_point_len,
     fido_blob_t *cbor_blob)
 {
 	es256_pk_t	*pk = NULL;
-	cbor_item_t	*pk_cbor = NULL;
-	size_t		 alloc_len;
 	int		 ok = -1;
 
 	/* only handle uncompressed points */
@@ -358,24 +504,18 @@ cbor_blob_from_ec_point(const uint8_t *ec_point, size_t ec_point_len,
 		goto fail;
 	}
 
-	if ((pk_cbor = es256_pk_encode(pk)) == NULL) {
-		log_debug("%s: es256_pk_encode", __func__);
+	if ((cbor_blob->ptr = malloc(ES256_PK_COSE_LEN)) == NULL ||
+	    es256_pk_encode_fixed(pk, cbor_blob->ptr, ES256_PK_COSE_LEN) < 0) {
+		log_debug("%s: es256_pk_encode_fixed", __func__);
 		goto fail;
 	}
 
-	if ((cbor_blob->len = cbor_serialize_alloc(pk_cbor, &cbor_blob->ptr,
-	    &alloc_len)) != 77) {
-		log_debug("%s: cbor_serialize_alloc", __func__);
-		goto fail;
-	}
+	cbor_blob->len = ES256_PK_COSE_LEN;
 
 	ok = 0;
 fail:
 	es256_pk_free(&pk);
 
-	if (pk_cbor)
-		cbor_decref(&pk_cbor);
-
 	return (ok);
 }
 
@@ -552,15 +692,16 @@ fail:
 }
 
 int
-u2f_register(fido_dev_t *dev, fido_cred_t *cred, int ms)
+u2f_register(fido_dev_t *dev, fido_cred_t *cred, int *ms)
 {
-	const uint8_t	 cmd = CTAP_FRAME_INIT | CTAP_CMD_MSG;
-	iso7816_apdu_t	*apdu = NULL;
-	unsigned char	 rp_id_hash[SHA256_DIGEST_LENGTH];
-	unsigned char	 reply[2048];
-	int		 reply_len;
-	int		 found;
-	int		 r;
+	const uint8_t		 cmd = CTAP_FRAME_INIT | CTAP_CMD_MSG;
+	iso7816_apdu_t		*apdu = NULL;
+	unsigned char		 rp_id_hash[SHA256_DIGEST_LENGTH];
+	const unsigned char	*reply;
+	u2f_poll_t		 up;
+	int			 reply_len;
+	size_t			 idx;
+	int			 r;
 
 	if (cred->rk == FIDO_OPT_TRUE || cred->uv == FIDO_OPT_TRUE) {
 		log_debug("%s: rk=%d, uv=%d", __func__, cred->rk, cred->uv);
@@ -574,27 +715,23 @@ u2f_register(fido_dev_t *dev, fido_cred_t *cred, int ms)
 		return (FIDO_ERR_INVALID_ARGUMENT);
 	}
 
-	for (size_t i = 0; i < cred->excl.len; i++) {
-		if ((r = key_lookup(dev, cred->rp.id, &cred->excl.ptr[i],
-		    &found, ms)) != FIDO_OK) {
-			log_debug("%s: key_lookup", __func__);
-			return (r);
-		}
-		if (found) {
-			if ((r = send_dummy_register(dev, ms)) != FIDO_OK) {
-				log_debug("%s: send_dummy_register", __func__);
-				return (r);
-			}
-			return (FIDO_ERR_CREDENTIAL_EXCLUDED);
-		}
-	}
-
 	memset(&rp_id_hash, 0, sizeof(rp_id_hash));
 
-	if (SHA256((const void *)cred->rp.id, strlen(cred->rp.id),
-	    rp_id_hash) != rp_id_hash) {
-		log_debug("%s: sha256", __func__);
+	if (rp_id_hash_get(cred->rp.id, rp_id_hash) < 0)
 		return (FIDO_ERR_INTERNAL);
+
+	if ((r = key_lookup(dev, rp_id_hash, cred->excl.ptr, cred->excl.len,
+	    &idx, ms)) != FIDO_OK) {
+		log_debug("%s: key_lookup", __func__);
+		return (r);
+	}
+
+	if (idx < cred->excl.len) {
+		if ((r = send_dummy_register(dev, ms)) != FIDO_OK) {
+			log_debug("%s: send_dummy_register", __func__);
+			return (r);
+		}
+		return (FIDO_ERR_CREDENTIAL_EXCLUDED);
 	}
 
 	if ((apdu = iso7816_new(U2F_CMD_REGISTER, 0, 2 *
@@ -606,21 +743,31 @@ u2f_register(fido_dev_t *dev, fido_cred_t *cred, int ms)
 		goto fail;
 	}
 
+	if (u2f_poll_begin(dev, &up) != 0) {
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+
 	do {
 		if (tx(dev, cmd, iso7816_ptr(apdu), iso7816_len(apdu)) < 0) {
 			log_debug("%s: tx", __func__);
 			r = FIDO_ERR_TX;
 			goto fail;
 		}
-		if ((reply_len = rx(dev, cmd, &reply, sizeof(reply), ms)) < 2) {
+		if ((reply_len = rx_msg(dev, cmd, &reply, ms)) < 2) {
 			log_debug("%s: rx", __func__);
-			r = FIDO_ERR_RX;
+			r = reply_len < 0 ? rx_error(ms) : FIDO_ERR_RX;
 			goto fail;
 		}
-#ifndef FIDO_FUZZ
-		usleep((ms == -1 ? 100 : ms) * 1000);
-#endif
-	} while (((reply[0] << 8) | reply[1]) == SW_CONDITIONS_NOT_SATISFIED);
+	} while (((reply[0] << 8) | reply[1]) == SW_CONDITIONS_NOT_SATISFIED &&
+	    u2f_poll_delay(dev, &up, ms) == 0);
+
+	u2f_poll_done(&up);
+
+	if (((reply[0] << 8) | reply[1]) == SW_CONDITIONS_NOT_SATISFIED) {
+		r = u2f_poll_error(dev);
+		goto fail;
+	}
 
 	if ((r = parse_register_reply(cred, reply,
 	    (size_t)reply_len)) != FIDO_OK) {
@@ -634,43 +781,25 @@ fail:
 }
 
 static int
-u2f_authenticate_single(fido_dev_t *dev, const fido_blob_t *key_id,
-    fido_assert_t *fa, size_t idx, int ms)
+u2f_authenticate_single(fido_dev_t *dev, const unsigned char *rp_id_hash,
+    const fido_blob_t *key_id, fido_assert_t *fa, int *ms)
 {
 	fido_blob_t	sig;
 	fido_blob_t	ad;
-	int		found;
 	int		r;
 
 	memset(&sig, 0, sizeof(sig));
 	memset(&ad, 0, sizeof(ad));
 
-	if ((r = key_lookup(dev, fa->rp_id, key_id, &found, ms)) != FIDO_OK) {
-		log_debug("%s: key_lookup", __func__);
-		goto fail;
-	}
-
-	if (!found) {
-		log_debug("%s: not found", __func__);
-		r = FIDO_ERR_CREDENTIAL_EXCLUDED;
-		goto fail;
-	}
-
-	if (fa->up == FIDO_OPT_FALSE) {
-		log_debug("%s: checking for key existence only", __func__);
-		r = FIDO_ERR_USER_PRESENCE_REQUIRED;
-		goto fail;
-	}
-
-	if ((r = do_auth(dev, &fa->cdh, fa->rp_id, key_id, &sig, &ad,
-	    ms)) != FIDO_OK) {
+	if ((r = do_auth(dev, &fa->cdh, fa->rp_id, rp_id_hash, key_id, &sig,
+	    &ad, ms)) != FIDO_OK) {
 		log_debug("%s: do_auth", __func__);
 		goto fail;
 	}
 
-	if (fido_blob_set(&fa->stmt[idx].id, key_id->ptr, key_id->len) < 0 ||
-	    fido_assert_set_authdata(fa, idx, ad.ptr, ad.len) != FIDO_OK ||
-	    fido_assert_set_sig(fa, idx, sig.ptr, sig.len) != FIDO_OK) {
+	if (fido_blob_set(&fa->stmt[0].id, key_id->ptr, key_id->len) < 0 ||
+	    fido_assert_set_authdata(fa, 0, ad.ptr, ad.len) != FIDO_OK ||
+	    fido_assert_set_sig(fa, 0, sig.ptr, sig.len) != FIDO_OK) {
 		log_debug("%s: fido_assert_set", __func__);
 		r = FIDO_ERR_INTERNAL;
 		goto fail;
@@ -690,11 +819,17 @@ fail:
 	return (r);
 }
 
+/*
+ * Sign with the first credential in the allow list that the authenticator
+ * recognises; credentials that don't exist are ignored.
+ */
 int
-u2f_authenticate(fido_dev_t *dev, fido_assert_t *fa, int ms)
+u2f_authenticate(fido_dev_t *dev, fido_assert_t *fa, int *ms)
 {
-	int	nauth_ok = 0;
-	int	r;
+	unsigned char	rp_id_hash[SHA256_DIGEST_LENGTH];
+	size_t		hint;
+	size_t		idx = fa->allow_list.len;
+	int		r;
 
 	if (fa->uv == FIDO_OPT_TRUE || fa->allow_list.ptr == NULL) {
 		log_debug("%s: uv=%d, allow_list=%p", __func__, fa->uv,
@@ -702,23 +837,56 @@ u2f_authenticate(fido_dev_t *dev, fido_assert_t *fa, int ms)
 		return (FIDO_ERR_UNSUPPORTED_OPTION);
 	}
 
-	if ((r = fido_assert_set_count(fa, fa->allow_list.len)) != FIDO_OK) {
+	if (fa->rp_id == NULL) {
+		log_debug("%s: rp_id=NULL", __func__);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	memset(&rp_id_hash, 0, sizeof(rp_id_hash));
+
+	if (rp_id_hash_get(fa->rp_id, rp_id_hash) < 0)
+		return (FIDO_ERR_INTERNAL);
+
+	if ((r = fido_assert_set_count(fa, 1)) != FIDO_OK) {
 		log_debug("%s: fido_assert_set_count", __func__);
 		return (r);
 	}
 
-	for (size_t i = 0; i < fa->allow_list.len; i++) {
-		if ((r = u2f_authenticate_single(dev, &fa->allow_list.ptr[i],
-		    fa, nauth_ok, ms)) == FIDO_OK) {
-			nauth_ok++;
-		} else if (r != FIDO_ERR_CREDENTIAL_EXCLUDED) {
-			log_debug("%s: u2f_authenticate_single", __func__);
+	/* try the handle last used with this rp, then the whole list */
+	if ((hint = fido_dev_hint_find(dev, fa->rp_id,
+	    &fa->allow_list)) < fa->allow_list.len) {
+		if ((r = key_lookup(dev, rp_id_hash, &fa->allow_list.ptr[hint],
+		    1, &idx, ms)) != FIDO_OK) {
+			log_debug("%s: key_lookup", __func__);
 			return (r);
 		}
-		/* ignore credentials that don't exist */
+		idx = idx == 0 ? hint : fa->allow_list.len;
+	}
+
+	if (idx == fa->allow_list.len && (r = key_lookup(dev, rp_id_hash,
+	    fa->allow_list.ptr, fa->allow_list.len, &idx, ms)) != FIDO_OK) {
+		log_debug("%s: key_lookup", __func__);
+		return (r);
+	}
+
+	if (idx == fa->allow_list.len) {
+		log_debug("%s: not found", __func__);
+		fa->stmt_len = 0;
+		return (FIDO_OK);
+	}
+
+	if (fa->up == FIDO_OPT_FALSE) {
+		log_debug("%s: checking for key existence only", __func__);
+		return (FIDO_ERR_USER_PRESENCE_REQUIRED);
+	}
+
+	if ((r = u2f_authenticate_single(dev, rp_id_hash,
+	    &fa->allow_list.ptr[idx], fa, ms)) != FIDO_OK) {
+		log_debug("%s: u2f_authenticate_single", __func__);
+		return (r);
 	}
 
-	fa->stmt_len = nauth_ok;
+	fido_dev_hint_put(dev, fa->rp_id, &fa->allow_list.ptr[idx]);
 
 	return (FIDO_OK);
 }
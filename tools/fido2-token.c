@@ -15,7 +15,7 @@ usage(void)
 {
 	fprintf(stderr,
 "usage: fido2-token [-CIRS] [-d] device\n"
-"       fido2-token -L [-d]\n" 
+"       fido2-token -L [-dw]\n" 
 "       fido2-token -V\n" 
 	);
 
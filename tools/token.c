@@ -112,6 +112,13 @@ print_maxmsgsiz(uint64_t maxmsgsiz)
 	printf("maxmsgsiz: %d\n", (int)maxmsgsiz);
 }
 
+static void
+print_maxcredlist(uint64_t maxcredcntlst, uint64_t maxcredidlen)
+{
+	printf("maxcredcntlst: %d\n", (int)maxcredcntlst);
+	printf("maxcredidlen: %d\n", (int)maxcredidlen);
+}
+
 static void
 print_byte_array(const char *label, const uint8_t *ba, size_t len)
 {
@@ -187,6 +194,10 @@ token_info(int argc, char **argv)
 	/* print maximum message size */
 	print_maxmsgsiz(fido_cbor_info_maxmsgsiz(ci));
 
+	/* print credential list limits */
+	print_maxcredlist(fido_cbor_info_maxcredcntlst(ci),
+	    fido_cbor_info_maxcredidlen(ci));
+
 	/* print supported pin protocols */
 	print_byte_array("pin protocols", fido_cbor_info_protocols_ptr(ci),
 	    fido_cbor_info_protocols_len(ci));
@@ -239,20 +250,63 @@ token_reset(int argc, char **argv)
 	exit(0);
 }
 
+static void
+print_dev_info(const char *prefix, const fido_dev_info_t *di)
+{
+	printf("%s%s: vendor=0x%04x, product=0x%04x (%s %s)\n", prefix,
+	    fido_dev_info_path(di),
+	    fido_dev_info_vendor(di),
+	    fido_dev_info_product(di),
+	    fido_dev_info_manufacturer_string(di),
+	    fido_dev_info_product_string(di));
+}
+
+static void
+watch_cb(void *arg, int event, const fido_dev_info_t *di)
+{
+	(void)arg;
+
+	print_dev_info(event == FIDO_DEV_ADDED ? "+ " : "- ", di);
+	fflush(stdout);
+}
+
+static void
+token_watch(void)
+{
+	fido_dev_registry_t *reg;
+	int r;
+
+	if ((reg = fido_dev_registry_new()) == NULL)
+		errx(1, "fido_dev_registry_new");
+
+	if ((r = fido_dev_registry_open(reg, watch_cb, NULL)) != FIDO_OK)
+		errx(1, "fido_dev_registry_open: %s (0x%x)", fido_strerr(r), r);
+
+	for (;;) {
+		if ((r = fido_dev_registry_update(reg, -1)) != FIDO_OK)
+			errx(1, "fido_dev_registry_update: %s (0x%x)",
+			    fido_strerr(r), r);
+	}
+}
+
 int
 token_list(int argc, char **argv)
 {
 	fido_dev_info_t *devlist;
 	size_t ndevs;
 	bool debug = false;
+	bool watch = false;
 	int ch;
 	int r;
 
-	while ((ch = getopt(argc, argv, "d")) != -1) {
+	while ((ch = getopt(argc, argv, "dw")) != -1) {
 		switch (ch) {
 		case 'd':
 			debug = true;
 			break;
+		case 'w':
+			watch = true;
+			break;
 		default:
 			usage();
 		}
@@ -260,21 +314,17 @@ token_list(int argc, char **argv)
 
 	fido_init(debug ? FIDO_DEBUG : 0);
 
+	if (watch)
+		token_watch();
+
 	if ((devlist = fido_dev_info_new(64)) == NULL)
 		errx(1, "fido_dev_info_new");
 
 	if ((r = fido_dev_info_manifest(devlist, 64, &ndevs)) != FIDO_OK)
 		errx(1, "fido_dev_info_manifest: %s (0x%x)", fido_strerr(r), r);
 
-	for (size_t i = 0; i < ndevs; i++) {
-		const fido_dev_info_t *di = fido_dev_info_ptr(devlist, i);
-		printf("%s: vendor=0x%04x, product=0x%04x (%s %s)\n",
-		    fido_dev_info_path(di),
-		    fido_dev_info_vendor(di),
-		    fido_dev_info_product(di),
-		    fido_dev_info_manufacturer_string(di),
-		    fido_dev_info_product_string(di));
-	}
+	for (size_t i = 0; i < ndevs; i++)
+		print_dev_info("", fido_dev_info_ptr(devlist, i));
 
 	fido_dev_info_free(&devlist, ndevs);
 